@@ -0,0 +1,86 @@
+#include "arena.h"
+#include <algorithm>
+#include <cstring>
+
+Arena::Arena() : _nextChunkSize(first_chunk)
+{
+
+}
+
+char *Arena::Chunk::begin()
+{
+    return data ? data.get() : &adopted[0];
+}
+
+const char *Arena::Chunk::begin() const
+{
+    return data ? data.get() : adopted.data();
+}
+
+Arena::Span Arena::store(const char *data, std::size_t length)
+{
+    Span span;
+    if (length == 0)
+        return span;
+    if (_chunks.empty() || _chunks.back().size - _chunks.back().used < length)
+    {
+        std::size_t size = std::max<std::size_t>(_nextChunkSize, length);
+        _chunks.push_back({std::unique_ptr<char[]>(new char[size]), std::string(), size, 0});
+        _nextChunkSize = std::min<std::size_t>(_nextChunkSize * 2, max_chunk);
+    }
+    Chunk &chunk = _chunks.back();
+    std::memcpy(chunk.begin() + chunk.used, data, length);
+    span.chunk = static_cast<uint32_t>(_chunks.size() - 1);
+    span.offset = static_cast<uint32_t>(chunk.used);
+    span.length = static_cast<uint32_t>(length);
+    chunk.used += length;
+    return span;
+}
+
+Arena::Span Arena::adopt(std::string &&buffer)
+{
+    Span span;
+    if (buffer.empty())
+        return span;
+    std::size_t size = buffer.size();
+    //Adopted chunk is full, so the next store() starts a new chunk after it
+    _chunks.push_back({std::unique_ptr<char[]>(), std::move(buffer), size, size});
+    span.chunk = static_cast<uint32_t>(_chunks.size() - 1);
+    span.length = static_cast<uint32_t>(size);
+    return span;
+}
+
+std::string_view Arena::view(const Span &span) const
+{
+    if (span.length == 0)
+        return std::string_view();
+    return std::string_view(_chunks[span.chunk].begin() + span.offset, span.length);
+}
+
+void Arena::reset()
+{
+    auto biggest = _chunks.end();
+    for (auto i = _chunks.begin(); i != _chunks.end(); ++i)
+    {
+        if (i->data && (biggest == _chunks.end() || i->size > biggest->size))
+            biggest = i;
+    }
+    if (biggest == _chunks.end())
+    {
+        _chunks.clear();
+        return;
+    }
+    Chunk kept = std::move(*biggest);
+    kept.used = 0;
+    _chunks.clear();
+    _chunks.push_back(std::move(kept));
+    _nextChunkSize = std::min<std::size_t>(_chunks.back().size * 2, max_chunk);
+}
+
+std::size_t Arena::capacity() const
+{
+    std::size_t capacity = 0;
+    for (auto &i : _chunks)
+        capacity += i.size;
+    return capacity;
+}
@@ -0,0 +1,50 @@
+#ifndef ARENA_H
+#define ARENA_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+//Chunked storage for variable-length values. Values are never freed one by one,
+//everything goes away at once on reset() or when the arena is destroyed.
+class Arena
+{
+public:
+    //Value is addressed by its chunk and offset inside of it, so it stays valid when the arena is moved
+    struct Span
+    {
+        uint32_t chunk = 0;
+        uint32_t offset = 0;
+        uint32_t length = 0;
+    };
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        std::string adopted;//Buffer taken over by adopt() instead of data
+        std::size_t size;
+        std::size_t used;
+        char *begin();
+        const char *begin() const;
+    };
+    enum {first_chunk = 4096, max_chunk = 1024 * 1024};
+    std::vector<Chunk> _chunks;
+    std::size_t _nextChunkSize;
+public:
+    Arena();
+    Arena(const Arena &other) = delete;
+    Arena(Arena &&other) = default;
+    Arena &operator = (const Arena &other) = delete;
+    Arena &operator = (Arena &&other) = default;
+    Span store(const char *data, std::size_t length);
+    //Takes over the buffer of a string without copying it. Returned span covers all of it
+    Span adopt(std::string &&buffer);
+    std::string_view view(const Span &span) const;
+    //Drops all values. The biggest chunk is kept for reuse
+    void reset();
+    std::size_t capacity() const;
+};
+
+#endif // ARENA_H
@@ -0,0 +1,24 @@
+TEMPLATE = app
+TARGET = benchmarks
+CONFIG += console c++17 thread release
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+LIBS += -lsqlite3 -lpthread
+
+SOURCES += \
+        main.cpp \
+        ../arena.cpp \
+        ../logger.cpp \
+        ../result.cpp \
+        ../sqlite_wrapper.cpp \
+        ../statementcache.cpp
+
+HEADERS += \
+        ../arena.h \
+        ../json.h \
+        ../logger.h \
+        ../result.h \
+        ../sqlite_wrapper.h \
+        ../statementcache.h
@@ -0,0 +1,319 @@
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "json.h"
+#include "logger.h"
+#include "result.h"
+#include "sqlite_wrapper.h"
+
+//Measures the paths rows take through the server: reading them from SQLite into a Result, adding values,
+//text and binary serialization and parsing, column lookups. Every benchmark runs on tables from narrow
+//to wide and from a thousand to millions of rows, filled with numbers or text. Results are printed and
+//written as JSON, so runs of different versions can be compared.
+
+using namespace std;
+using Clock = chrono::steady_clock;
+
+namespace
+{
+struct Options
+{
+    double minTime = 0.5;//Seconds every benchmark is repeated for
+    int maxRows = 2000000;
+    string filter;
+    string output = "benchmark_results.json";
+    string directory = "/tmp";
+};
+
+struct Shape
+{
+    int columns;
+    int rows;
+    bool text;
+    string name() const
+    {
+        return to_string(columns) + "x" + to_string(rows) + (text ? "/text" : "/numeric");
+    }
+};
+
+struct Measurement
+{
+    string benchmark;
+    Shape shape;
+    size_t runs;
+    double medianNs;
+    double minNs;
+    double items;//Rows, values or lookups handled by one run
+    size_t bytes;//Size of the serialized result, 0 if it doesn't apply
+};
+
+const int columnCounts[] = {2, 8, 64};
+const int rowCounts[] = {1000, 100000, 2000000};
+const size_t maxNumericCells = 16000000;
+const size_t maxTextCells = 4000000;
+
+vector<Measurement> measurements;
+volatile long long sink;
+
+//Runs operation for at least minTime seconds and 3 times. prepare is run before every run and isn't timed
+void measure(const Options &options, const string &benchmark, const Shape &shape, double items, size_t bytes,
+             const function<void()> &operation, const function<void()> &prepare = nullptr)
+{
+    string name = benchmark + "/" + shape.name();
+    if (!options.filter.empty() && name.find(options.filter) == string::npos)
+        return;
+    vector<double> times;
+    Clock::duration total = Clock::duration::zero();
+    if (prepare)
+        prepare();
+    operation();//Warm up
+    while (times.size() < 3 || total < chrono::duration<double>(options.minTime))
+    {
+        if (prepare)
+            prepare();
+        Clock::time_point start = Clock::now();
+        operation();
+        Clock::duration time = Clock::now() - start;
+        total += time;
+        times.push_back(chrono::duration<double, nano>(time).count());
+    }
+    sort(times.begin(), times.end());
+    Measurement measurement{benchmark, shape, times.size(), times[times.size() / 2], times.front(), items, bytes};
+    measurements.push_back(measurement);
+    printf("%-40s %8zu runs %14.0f ns %10.1f ns/item %12.0f items/s\n", name.c_str(), measurement.runs,
+           measurement.medianNs, measurement.medianNs / items, items * 1e9 / measurement.medianNs);
+    fflush(stdout);
+}
+
+string columnName(int column)
+{
+    return "column_" + to_string(column);
+}
+
+//Fills table t with shape.rows rows. Numeric tables alternate INTEGER and REAL columns, text ones
+//have 24 to 26 characters in every value
+bool createTable(Sqlite_wrapper &database, const Shape &shape)
+{
+    string columns, values;
+    for (int i = 0; i < shape.columns; i++)
+    {
+        columns += (i != 0 ? ", " : "") + columnName(i);
+        values += i != 0 ? ", " : "";
+        if (shape.text)
+            values += "hex(randomblob(12)) || " + to_string(i);
+        else if (i % 2 == 0)
+            values += "x * " + to_string(i + 1);
+        else
+            values += "x * 0.25 + " + to_string(i);
+    }
+    database.modifyingExec("drop table if exists t");
+    database.modifyingExec("create table t (" + columns + ")");
+    database.modifyingExec("with recursive n(x) as (select 1 union all select x + 1 from n limit " + to_string(shape.rows)
+                           + ") insert into t select " + values + " from n");
+    return database.getLastError().empty();
+}
+
+void benchmarkShape(const Options &options, Sqlite_wrapper &database, const Shape &shape)
+{
+    string rowsOf = "select * from t";
+    double cells = static_cast<double>(shape.rows) * shape.columns;
+    measure(options, "sqlite_read", shape, shape.rows, 0, [&] {
+        database.readExec(rowsOf);
+    });
+    measure(options, "sqlite_fetch_64k", shape, shape.rows, 0, [&] {
+        Result chunk;
+        database.openCursor(rowsOf);
+        while (database.fetch(chunk, 64 * 1024))
+            ;
+    });
+    Result rows(database.readExec(rowsOf));
+    if (!database.getLastError().empty() || static_cast<int>(rows.rows()) != shape.rows)
+    {
+        cerr << "Table of " << shape.name() << " couldn't be read: " << database.getLastError() << endl;
+        return;
+    }
+
+    vector<string> values;
+    values.reserve(static_cast<size_t>(cells));
+    for (int row = 0; row < shape.rows; row++)
+    {
+        for (int column = 0; column < shape.columns; column++)
+            values.push_back(rows.valueAt(column, row));
+    }
+    Result added;
+    measure(options, "result_add_value", shape, cells, 0, [&] {
+        size_t cell = 0;
+        for (int row = 0; row < shape.rows; row++)
+        {
+            for (int column = 0; column < shape.columns; column++)
+                added.addValue(values[cell++], column);
+        }
+    }, [&] {
+        added = Result();
+        added.resize(shape.columns);
+        for (int column = 0; column < shape.columns; column++)
+            added.addColumn(columnName(column), column);
+    });
+    values = vector<string>();
+
+    string text = rows.resultToString();
+    measure(options, "result_to_string", shape, shape.rows, text.size(), [&] {
+        sink = rows.resultToString().size();
+    });
+    Result parsed;
+    measure(options, "result_from_string", shape, shape.rows, text.size(), [&] {
+        parsed.resultFromString(text);
+    }, [&] {
+        parsed.clear();
+    });
+    text = string();
+
+    string binary = rows.resultToBinary();
+    measure(options, "result_to_binary", shape, shape.rows, binary.size(), [&] {
+        sink = rows.resultToBinary().size();
+    });
+    measure(options, "result_from_binary", shape, shape.rows, binary.size(), [&] {
+        parsed.resultFromBinary(binary);
+    }, [&] {
+        parsed.clear();
+    });
+
+    //Lookups don't depend on rows, so they are measured once per width
+    if (shape.rows == rowCounts[0])
+    {
+        vector<string> names;
+        for (int column = 0; column < shape.columns; column++)
+            names.push_back(columnName(column));
+        names.push_back("missing");
+        const int rounds = 1000;
+        measure(options, "get_index_of", shape, static_cast<double>(names.size()) * rounds, 0, [&] {
+            long long sum = 0;
+            for (int i = 0; i < rounds; i++)
+            {
+                for (auto &name : names)
+                    sum += rows.getIndexOf(name);
+            }
+            sink = sum;
+        });
+    }
+}
+
+string jsonString(const string &value)
+{
+    string out;
+    appendJsonString(out, value);
+    return out;
+}
+
+bool writeResults(const string &path)
+{
+    ofstream file(path, ios::trunc);
+    if (!file)
+        return false;
+    char timestamp[32];
+    time_t now = time(nullptr);
+    strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+    file << "{\n  \"timestamp\": " << jsonString(timestamp) << ",\n  \"sqlite\": " << jsonString(sqlite3_libversion())
+         << ",\n  \"compiler\": " << jsonString(__VERSION__) << ",\n  \"results\": [";
+    for (size_t i = 0; i < measurements.size(); i++)
+    {
+        const Measurement &m = measurements[i];
+        file << (i != 0 ? "," : "") << "\n    {\"benchmark\": " << jsonString(m.benchmark) << ", \"columns\": " << m.shape.columns
+             << ", \"rows\": " << m.shape.rows << ", \"data\": " << (m.shape.text ? "\"text\"" : "\"numeric\"")
+             << ", \"runs\": " << m.runs << ", \"median_ns\": " << static_cast<long long>(m.medianNs)
+             << ", \"min_ns\": " << static_cast<long long>(m.minNs) << ", \"ns_per_item\": " << m.medianNs / m.items
+             << ", \"items_per_s\": " << static_cast<long long>(m.items * 1e9 / m.medianNs) << ", \"bytes\": " << m.bytes << "}";
+    }
+    file << "\n  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+void printUsage(const char *program)
+{
+    cout << "Usage: " << program << " [options]\n"
+         << "  --filter <text>       run only benchmarks whose name, e.g. result_to_string/8x100000/text, contains text\n"
+         << "  --min-time <sec>      time every benchmark is repeated for (default 0.5)\n"
+         << "  --max-rows <n>        skip tables with more rows (default 2000000)\n"
+         << "  --output <path>       JSON file with the results (default benchmark_results.json)\n"
+         << "  --directory <path>    directory for the temporary database (default /tmp)" << endl;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0 || i + 1 >= argc)
+        {
+            printUsage(argv[0]);
+            return strcmp(argv[i], "--help") == 0 ? 0 : 1;
+        }
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(option, "--filter") == 0)
+            options.filter = value;
+        else if (strcmp(option, "--min-time") == 0)
+            options.minTime = atof(value);
+        else if (strcmp(option, "--max-rows") == 0)
+            options.maxRows = atoi(value);
+        else if (strcmp(option, "--output") == 0)
+            options.output = value;
+        else if (strcmp(option, "--directory") == 0)
+            options.directory = value;
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    Logger::setLevel(Logger::Error);
+    string file = options.directory + "/database_server_benchmark_" + to_string(getpid()) + ".db";
+    unique_ptr<Sqlite_wrapper> database(Sqlite_wrapper::connectToDatabase(file));
+    if (!database)
+    {
+        cerr << "Database " << file << " couldn't be created" << endl;
+        return 1;
+    }
+    int status = 0;
+    for (bool text : {false, true})
+    {
+        for (int columns : columnCounts)
+        {
+            for (int rows : rowCounts)
+            {
+                size_t cells = static_cast<size_t>(columns) * rows;
+                if (rows > options.maxRows || cells > (text ? maxTextCells : maxNumericCells))
+                    continue;
+                Shape shape{columns, rows, text};
+                if (!createTable(*database, shape))
+                {
+                    cerr << "Table of " << shape.name() << " couldn't be created: " << database->getLastError() << endl;
+                    status = 1;
+                    continue;
+                }
+                benchmarkShape(options, *database, shape);
+            }
+        }
+    }
+    database.reset();
+    for (const char *suffix : {"", "-wal", "-shm"})
+        remove((file + suffix).c_str());
+    if (!writeResults(options.output))
+    {
+        cerr << "Results couldn't be written to " << options.output << endl;
+        return 1;
+    }
+    cout << measurements.size() << " results were written to " << options.output << endl;
+    return status;
+}
@@ -0,0 +1,81 @@
+#include "compressor.h"
+#include <zlib.h>
+#include <algorithm>
+#include <limits>
+
+Compressor::Compressor(std::size_t threshold) : _threshold(threshold), _compressed(0), _incompressible(0),
+    _uncompressedBytes(0), _compressedBytes(0)
+{
+
+}
+
+bool Compressor::supports(uint8_t compression)
+{
+    return compression == Request::Zlib;
+}
+
+bool Compressor::deflate(const char *in, std::size_t size, int level, std::string &out)
+{
+    if (size > std::numeric_limits<uLong>::max())
+        return false;
+    uLongf length = compressBound(static_cast<uLong>(size));
+    out.resize(length);
+    if (compress2(reinterpret_cast<Bytef *>(&out[0]), &length, reinterpret_cast<const Bytef *>(in), static_cast<uLong>(size),
+                  level == 0 ? Z_DEFAULT_COMPRESSION : std::min(std::max(level, 1), 9)) != Z_OK)
+        return false;
+    out.resize(length);
+    return true;
+}
+
+bool Compressor::inflate(const char *in, std::size_t size, std::string &out)
+{
+    z_stream stream = {};
+    if (inflateInit(&stream) != Z_OK)
+        return false;
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in));
+    stream.avail_in = static_cast<uInt>(size);
+    out.clear();
+    int status = Z_OK;
+    while (status == Z_OK)
+    {
+        std::size_t written = out.size();
+        out.resize(written + std::max<std::size_t>(size * 4, 64 * 1024));
+        stream.next_out = reinterpret_cast<Bytef *>(&out[written]);
+        stream.avail_out = static_cast<uInt>(out.size() - written);
+        status = ::inflate(&stream, Z_NO_FLUSH);
+        out.resize(out.size() - stream.avail_out);
+    }
+    inflateEnd(&stream);
+    return status == Z_STREAM_END && stream.avail_in == 0;
+}
+
+bool Compressor::compress(const Request &request, Response &response)
+{
+    const std::string &body = response.body();
+    if (!(request.flags & Request::Compressed) || response.status != Response::Ok || body.size() < _threshold
+            || !supports(request.compression))
+        return false;
+    std::string compressed;
+    if (!deflate(body.data(), body.size(), request.compressionLevel, compressed) || compressed.size() >= body.size())
+    {
+        _incompressible++;
+        return false;
+    }
+    _compressed++;
+    _uncompressedBytes += body.size();
+    _compressedBytes += compressed.size();
+    response.payload.swap(compressed);
+    response.shared.reset();
+    response.flags |= Response::Compressed;
+    return true;
+}
+
+Compressor::Statistics Compressor::statistics() const
+{
+    Statistics statistics;
+    statistics.compressed = _compressed;
+    statistics.incompressible = _incompressible;
+    statistics.uncompressedBytes = _uncompressedBytes;
+    statistics.compressedBytes = _compressedBytes;
+    return statistics;
+}
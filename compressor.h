@@ -0,0 +1,40 @@
+#ifndef COMPRESSOR_H
+#define COMPRESSOR_H
+#include <atomic>
+#include <cstddef>
+#include <string>
+
+#include "protocol.h"
+
+//Compresses responses of requests with the Compressed flag, see protocol.h. Every frame is compressed
+//on its own, so chunks of a streamed result can be decompressed as they arrive. Runs on database threads
+//next to serialization, network threads only send the compressed bytes.
+class Compressor
+{
+public:
+    struct Statistics
+    {
+        unsigned long long compressed = 0;//Responses sent compressed
+        unsigned long long incompressible = 0;//Responses sent as they were because compressing didn't make them smaller
+        unsigned long long uncompressedBytes = 0;//Bodies of compressed responses before and after compression
+        unsigned long long compressedBytes = 0;
+    };
+private:
+    std::size_t _threshold;
+    std::atomic<unsigned long long> _compressed, _incompressible, _uncompressedBytes, _compressedBytes;
+public:
+    //Bodies shorter than threshold bytes are sent uncompressed
+    explicit Compressor(std::size_t threshold);
+    Compressor(const Compressor &other) = delete;
+    Compressor &operator = (const Compressor &other) = delete;
+    static bool supports(uint8_t compression);
+    //zlib stream of size bytes of in. level is 1 to 9, 0 - the default of zlib
+    static bool deflate(const char *in, std::size_t size, int level, std::string &out);
+    static bool inflate(const char *in, std::size_t size, std::string &out);
+    //Replaces the body of a successful response with its compressed form and sets the Compressed flag
+    //if the request asked for it, the body is long enough and it got smaller. Returns true if it did
+    bool compress(const Request &request, Response &response);
+    Statistics statistics() const;
+};
+
+#endif // COMPRESSOR_H
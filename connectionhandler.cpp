@@ -1,13 +1,22 @@
 #include "connectionhandler.h"
-#include <iostream>
-ConnectionHandler::ConnectionHandler(boost::asio::io_service &service) : _socket(service)
+#include "logger.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+ConnectionHandler::ConnectionHandler(boost::asio::io_service &service, const Services &services) :
+    _socket(service), _strand(service), dataLength(0), _pool(services.pool), _executor(services.executor), _writes(services.writes),
+    _flights(services.flights), _metrics(services.metrics), _cache(services.cache), _tracer(services.tracer), _traceFile(services.traceFile),
+    _queryTimeout(services.queryTimeout), _queueByClient(services.queueByClient),
+    _compressor(services.compressor),
+    orderedRunning(false), pendingWriteBytes(0), writing(false), reading(false), peerClosed(false), inFlight(0)
 {
 
 }
 
-ConnectionHandler::pointer ConnectionHandler::create(boost::asio::io_service &service)
+ConnectionHandler::pointer ConnectionHandler::create(boost::asio::io_service &service, const Services &services)
 {
-    return pointer(new ConnectionHandler(service));
+    return pointer(new ConnectionHandler(service, services));
 }
 
 boost::asio::ip::tcp::socket &ConnectionHandler::socket()
@@ -17,62 +26,647 @@ boost::asio::ip::tcp::socket &ConnectionHandler::socket()
 
 void ConnectionHandler::start()
 {
-    _socket.async_read_some(boost::asio::buffer(data, message_length),
-                            boost::bind(&ConnectionHandler::handle_read, shared_from_this(),
-                                        boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
-    _socket.async_write_some(boost::asio::buffer(queryResult, queryResult.size()),
-                             boost::bind(&ConnectionHandler::handle_write, shared_from_this(),
-                                         boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred));
+    boost::system::error_code err;
+    remoteAddress = _socket.remote_endpoint(err).address().to_string();
+    _strand.dispatch(boost::bind(&ConnectionHandler::startRead, shared_from_this()));
+}
+
+void ConnectionHandler::startRead()
+{
+    if (reading || peerClosed || !_socket.is_open())
+        return;
+    reading = true;
+    if (data.size() < dataLength + read_chunk)
+        data.resize(dataLength + read_chunk);
+    _socket.async_read_some(boost::asio::buffer(data.data() + dataLength, data.size() - dataLength),
+                            _strand.wrap(boost::bind(&ConnectionHandler::handle_read, shared_from_this(),
+                                                     boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
+}
+
+std::vector<std::vector<std::string>> ConnectionHandler::takeParameters(std::string &query)
+{
+    std::vector<std::vector<std::string>> rows;
+    auto pos = query.find('\x1E');
+    if (pos == std::string::npos)
+        return rows;
+    std::string::size_type start = pos + 1, end;
+    do
+    {
+        end = query.find('\x1E', start);
+        std::vector<std::string> row;
+        std::string::size_type valueStart = start, valueEnd;
+        do
+        {
+            valueEnd = query.find('\x1F', valueStart);
+            if (valueEnd > end)
+                valueEnd = end;
+            row.push_back(query.substr(valueStart, valueEnd - valueStart));
+            valueStart = valueEnd + 1;
+        } while (valueEnd != end);
+        rows.push_back(std::move(row));
+        start = end + 1;
+    } while (end != std::string::npos);
+    query.erase(pos);
+    return rows;
 }
 
 void ConnectionHandler::handle_read(const boost::system::error_code &err, size_t bytes_received)
 {
     if (!err)
     {
-        std::cout << "Query received from " << _socket.remote_endpoint().address().to_string() << '\n'
-                  << "Bytes received " << bytes_received << std::endl;
-        auto pos = data.find_first_of('\t');
-        std::string databaseName = data.substr(0, pos);
-        data.erase(0, pos + 1);
-        bool select = false;
-        if (data.find_first_of("select") != std::string::npos)
-            select = true;
-        auto database = std::unique_ptr<Sqlite_wrapper>(Sqlite_wrapper::connectToDatabase(databaseName));
-        if (select)
+        if (_tracer.sampling() != 0)
+            lastRead = Metrics::Clock::now();
+        if (Logger::enabled(Logger::Debug))
+            Logger::debug("connection", std::to_string(bytes_received) + " bytes received from " + remoteAddress);
+        dataLength += bytes_received;
+        //Requests answered right away, e.g. Metrics, call startRead() while frames are parsed.
+        //Next read must not start before parsed frames are removed from the buffer
+        bool parsed = parseFrames();
+        reading = false;
+        if (!parsed)
+        {
+            Logger::warning("connection", "Malformed request from " + remoteAddress);
+            _socket.close();
+            cancelRunning();
+            return;
+        }
+        if (inFlight < max_in_flight)
+            startRead();
+    }
+    else if (err == boost::asio::error::eof)
+    {
+        //A closed socket and a half-closed one look the same from here, so running requests are cancelled
+        //and their responses, errors or results which were already done, are written before closing
+        reading = false;
+        peerClosed = true;
+        cancelRunning();
+        closeIfDone();
+    }
+    else
+    {
+        reading = false;
+        Logger::error("connection", remoteAddress + ": " + err.message());
+        _socket.close();
+        cancelRunning();
+    }
+}
+
+bool ConnectionHandler::parseFrames()
+{
+    std::size_t offset = 0;
+    while (dataLength - offset >= Protocol::lengthSize)
+    {
+        uint32_t length = Protocol::getUint32(data.data() + offset);
+        if (length > Protocol::maxFrameLength)
+            return false;
+        if (dataLength - offset < Protocol::lengthSize + length)
         {
-            try {
-                database->readExec(data);
-                queryResult = database->getLastResult().resultToString();
-            } catch (std::exception &e) {
-               queryResult = e.what();
+            //Make room for the rest of a large frame at once
+            if (data.size() < offset + Protocol::lengthSize + length)
+                data.resize(offset + Protocol::lengthSize + length);
+            break;
+        }
+        JobPointer job = std::make_shared<Job>();
+        if (_tracer.sampling() != 0)
+        {
+            job->read = lastRead;
+            job->decoding = Metrics::Clock::now();
+        }
+        if (!Protocol::decodeRequest(data.data() + offset + Protocol::lengthSize, length, job->request))
+            return false;
+        offset += Protocol::lengthSize + length;
+        dispatch(job);
+    }
+    if (offset != 0)
+    {
+        std::memmove(data.data(), data.data() + offset, dataLength - offset);
+        dataLength -= offset;
+    }
+    return true;
+}
+
+void ConnectionHandler::dispatch(JobPointer job)
+{
+    inFlight++;
+    job->response.id = job->request.id;
+    job->received = Metrics::Clock::now();
+    if (job->request.type == Request::Metrics)
+    {
+        job->request.flags |= Request::Unordered;
+        job->response.payload = _metrics.dump();
+        complete(job);
+        return;
+    }
+    if (job->request.type == Request::Trace)
+    {
+        trace(job);
+        return;
+    }
+    if (job->request.type == Request::Cancel)
+    {
+        cancel(job);
+        return;
+    }
+    if (job->request.type != Request::Query)
+    {
+        job->request.flags |= Request::Unordered;
+        job->response.status = Response::Error;
+        job->response.payload = "Unknown request type " + std::to_string(job->request.type);
+        complete(job);
+        return;
+    }
+    if ((job->request.flags & Request::Compressed) && !Compressor::supports(job->request.compression))
+    {
+        job->request.flags |= Request::Unordered;
+        job->response.status = Response::Error;
+        job->response.payload = "Unknown compression " + std::to_string(job->request.compression);
+        complete(job);
+        return;
+    }
+    job->database = ConnectionPool::normalizedName(job->request.database);
+    job->timeout = job->request.flags & Request::Timeout ? std::chrono::milliseconds(job->request.timeout) : _queryTimeout;
+    if (job->timeout.count() != 0)
+        job->deadline = job->received + job->timeout;
+    running[job->request.id] = job;
+    if (job->decoding != Metrics::Clock::time_point() && (job->trace = _tracer.sample()) != 0)
+    {
+        _tracer.span("read", job->trace, job->read, job->decoding, remoteAddress);
+        _tracer.span("decode", job->trace, job->decoding, job->received, job->database);
+    }
+    if (job->request.flags & Request::Unordered)
+        post(job);
+    else
+    {
+        ordered.push_back(job);
+        runOrdered();
+    }
+}
+
+void ConnectionHandler::trace(JobPointer job)
+{
+    job->request.flags |= Request::Unordered;
+    char *end = nullptr;
+    unsigned long every = std::strtoul(job->request.query.c_str(), &end, 10);
+    if (job->request.query.empty() || *end != '\0')
+    {
+        job->response.status = Response::Error;
+        job->response.payload = "Trace request needs the number of requests to trace one of, 0 stops tracing";
+    }
+    else if (every != 0)
+    {
+        _tracer.setSampling(static_cast<unsigned int>(every));
+        job->response.payload = "Tracing every " + std::to_string(every) + " requests";
+    }
+    else
+    {
+        _tracer.setSampling(0);
+        if (_executor.postUnbounded(boost::bind(&ConnectionHandler::writeTrace, shared_from_this(), job)))
+            return;
+        job->response.status = Response::Error;
+        job->response.payload = "Tracing stopped, server is shutting down and the trace wasn't written";
+    }
+    complete(job);
+}
+
+void ConnectionHandler::writeTrace(JobPointer job)
+{
+    std::size_t events = 0;
+    if (_tracer.write(_traceFile, events))
+        job->response.payload = "Tracing stopped, " + std::to_string(events) + " events were written to " + _traceFile;
+    else
+    {
+        job->response.status = Response::Error;
+        job->response.payload = "Tracing stopped, trace couldn't be written to " + _traceFile;
+    }
+    _strand.post(boost::bind(&ConnectionHandler::complete, shared_from_this(), job));
+}
+
+void ConnectionHandler::cancel(JobPointer job)
+{
+    job->request.flags |= Request::Unordered;
+    char *end = nullptr;
+    unsigned long id = std::strtoul(job->request.query.c_str(), &end, 10);
+    auto found = job->request.query.empty() || *end != '\0' ? running.end() : running.find(static_cast<uint32_t>(id));
+    if (found == running.end())
+    {
+        job->response.status = Response::Error;
+        job->response.payload = "Request " + job->request.query + " is not running";
+    }
+    else
+    {
+        found->second->cancelled = true;
+        job->response.payload = "Request " + job->request.query + " was cancelled";
+    }
+    complete(job);
+}
+
+void ConnectionHandler::cancelRunning()
+{
+    for (auto &i : running)
+        i.second->cancelled = true;
+}
+
+std::string ConnectionHandler::interruptionError(const Job &job, Sqlite_wrapper::Interruption interruption)
+{
+    if (interruption == Sqlite_wrapper::Cancelled)
+        return "Query was cancelled";
+    if (interruption == Sqlite_wrapper::DeadlineExceeded)
+        return "Query was interrupted by its deadline of " + std::to_string(job.timeout.count()) + " ms";
+    return std::string();
+}
+
+void ConnectionHandler::runOrdered()
+{
+    if (orderedRunning || ordered.empty())
+        return;
+    orderedRunning = true;
+    JobPointer job = ordered.front();
+    ordered.pop_front();
+    post(job);
+}
+
+void ConnectionHandler::post(JobPointer job)
+{
+    std::chrono::milliseconds retryAfter(0);
+    if (!_executor.post(_queueByClient ? remoteAddress : job->database, boost::bind(&ConnectionHandler::execute, shared_from_this(), job), &retryAfter))
+    {
+        job->response.status = Response::Busy;
+        job->response.payload = "Server is busy, please retry after " + std::to_string(retryAfter.count()) + " ms";
+        complete(job);
+    }
+}
+
+void ConnectionHandler::execute(JobPointer job)
+{
+    Metrics::Clock::time_point now = Metrics::Clock::now();
+    //Set already if the job runs again because the read it waited for was interrupted
+    if (job->started == Metrics::Clock::time_point())
+    {
+        job->started = now;
+        _tracer.wait("queue_wait", job->trace, job->received, job->started);
+    }
+    if (job->cancelled || now >= job->deadline)
+    {
+        job->response.status = Response::Error;
+        job->response.payload = interruptionError(*job, job->cancelled ? Sqlite_wrapper::Cancelled : Sqlite_wrapper::DeadlineExceeded);
+        _strand.post(boost::bind(&ConnectionHandler::complete, shared_from_this(), job));
+        return;
+    }
+    std::string &query = job->request.query;
+    if (!job->parametersTaken)
+    {
+        job->parameters = takeParameters(query);
+        job->parametersTaken = true;
+    }
+    auto &parameters = job->parameters;
+    job->statement = Metrics::shape(StatementCache::normalize(query));
+    bool binary = job->request.flags & Request::Binary;
+    bool streamed = job->request.flags & Request::Streamed;
+    std::string key, flight;
+    unsigned long long cacheVersion = 0;
+    Sqlite_wrapper::Interruption interruption = Sqlite_wrapper::NotInterrupted;
+    if (!streamed)
+        key = ResultCache::key(job->request.database, query, parameters, binary);
+    if (_cache != nullptr && !streamed && (job->response.shared = _cache->get(key)))
+    {
+        if (binary)
+            job->response.flags |= Response::Binary;
+        _tracer.span("cache_hit", job->trace, job->started, Metrics::Clock::now(), job->statement);
+        compress(*job, job->response);
+        _strand.post(boost::bind(&ConnectionHandler::complete, shared_from_this(), job));
+        return;
+    }
+    try {
+        //Queries are read on read-only connections concurrently with the writer of the database.
+        //SQLite tells from the prepared statements whether they change anything
+        auto database = _pool.acquireReader(job->request.database);
+        Metrics::Clock::time_point acquired = Metrics::Clock::now();
+        _tracer.span("acquire_connection", job->trace, job->started, acquired, job->database);
+        //PRAGMAs which only report something are read like queries, other statements which must run alone go to the writer
+        if ((WriteQueue::mustRunAlone(query) && !WriteQueue::isReportingPragma(query)) || !database->readsOnly(query))
+        {
+            database.release();
+            write(job, parameters);
+            return;
+        }
+        if (parameters.size() > 1)
+            throw std::invalid_argument("Batch parameters can be used with modifying queries only");
+        if (streamed)
+        {
+            //Rows are read by stream(), opening the cursor runs nothing yet
+            if (parameters.empty() ? database->openCursor(query) : database->openCursor(query, parameters.front()))
+            {
+                if (!binary)
+                    Result::streamHeaderToString(job->chunk, database->cursorColumns());
+                job->connection.reset(new PooledConnection(std::move(database)));
+                stream(job);
+                return;
+            }
+        }
+        else
+        {
+            //Same read which is already running answers this one too, unless a write was acknowledged since it started
+            flight = key + '\0' + std::to_string(_writes.generation(job->request.database));
+            pointer self = shared_from_this();
+            if (!_flights.join(flight, [self, job, acquired](const Response *response) {
+                //Read was interrupted for its own client, this one runs again with its own deadline
+                if (response == nullptr)
+                {
+                    if (!self->_executor.postUnbounded(boost::bind(&ConnectionHandler::execute, self, job)))
+                    {
+                        job->response.status = Response::Busy;
+                        job->response.payload = "Server is busy, please retry later";
+                        self->_strand.post(boost::bind(&ConnectionHandler::complete, self, job));
+                    }
+                    return;
+                }
+                job->response.status = response->status;
+                job->response.flags = response->flags;
+                job->response.payload = response->payload;
+                job->response.shared = response->shared;
+                job->executed = Metrics::Clock::now();
+                self->_tracer.wait("single_flight", job->trace, acquired, job->executed);
+                self->compress(*job, job->response);
+                self->_strand.post(boost::bind(&ConnectionHandler::complete, self, job));
+            }))
+                return;
+            if (_cache != nullptr)
+                cacheVersion = _cache->missed(job->request.database);
+            database->setInterruption(job->deadline, &job->cancelled);
+            if (parameters.empty())
+                database->readExec(query);
+            else
+                database->readExec(query, parameters.front());
+            interruption = database->interruption();
+            database->clearInterruption();
+            job->executed = Metrics::Clock::now();
+            _tracer.span("execute", job->trace, acquired, job->executed, job->statement);
+            if (database->getLastError().empty())
+            {
+                Result &result = database->getLastResult();
+                job->response.shared = std::make_shared<const std::string>(binary ? result.resultToBinary() : result.resultToString());
+                job->serialized = Metrics::Clock::now();
+                _tracer.span("serialize", job->trace, job->executed, job->serialized);
+                if (binary)
+                    job->response.flags |= Response::Binary;
+                std::set<std::string> tables;
+                if (_cache != nullptr && database->tablesOf(query, false, tables))
+                    _cache->put(job->request.database, key, job->response.shared, tables, cacheVersion);
             }
         }
+        if (!database->getLastError().empty())
+        {
+            job->response.status = Response::Error;
+            job->response.payload = interruption != Sqlite_wrapper::NotInterrupted
+                    ? interruptionError(*job, interruption) : database->getLastError();
+        }
+        //Snapshot of a script which began a transaction must not stay with the pooled connection
+        if (database->inTransaction())
+            database->modifyingExec("rollback");
+    } catch (std::exception &e) {
+        job->response.status = Response::Error;
+        job->response.payload = e.what();
+    }
+    //Waiters get the response uncompressed, they may want another compression.
+    //Deadline and cancellation of this request are not theirs, so they don't get its interruption
+    if (!flight.empty() && interruption != Sqlite_wrapper::NotInterrupted)
+        _flights.abandon(flight);
+    else if (!flight.empty())
+        _flights.land(flight, job->response);
+    compress(*job, job->response);
+    _strand.post(boost::bind(&ConnectionHandler::complete, shared_from_this(), job));
+}
+
+void ConnectionHandler::write(JobPointer job, std::vector<std::vector<std::string>> &parameters)
+{
+    pointer self = shared_from_this();
+    Metrics::Clock::time_point submitted = Metrics::Clock::now();
+    WriteQueue::Write write{std::move(job->request.query), std::move(parameters),
+                [self, job, submitted](const std::string &error, Result &rows) {
+        job->executed = Metrics::Clock::now();
+        self->_tracer.wait("write_queue", job->trace, submitted, job->executed);
+        if (error.empty() && rows.size() != 0)
+        {
+            //E.g. INSERT ... RETURNING, answered like a read
+            bool binary = job->request.flags & Request::Binary;
+            job->response.shared = std::make_shared<const std::string>(binary ? rows.resultToBinary() : rows.resultToString());
+            job->serialized = Metrics::Clock::now();
+            self->_tracer.span("serialize", job->trace, job->executed, job->serialized);
+            if (binary)
+                job->response.flags |= Response::Binary;
+            self->compress(*job, job->response);
+        }
+        else if (error.empty())
+            job->response.payload = "Query was made succesfully";
         else
-            try {
-                database->modifyingExec(data);
-                queryResult = "Query was made succesfully";
-        } catch (std::exception &e) {
-            queryResult = e.what();
+        {
+            job->response.status = Response::Error;
+            job->response.payload = error;
         }
+        self->_strand.post(boost::bind(&ConnectionHandler::complete, self, job));
+    }, job->deadline, &job->cancelled};
+    if (!_writes.submit(job->request.database, std::move(write)))
+    {
+        job->response.status = Response::Busy;
+        job->response.payload = "Server is busy, please retry later";
+        _strand.post(boost::bind(&ConnectionHandler::complete, self, job));
+    }
+}
+
+void ConnectionHandler::stream(JobPointer job)
+{
+    Metrics::Clock::time_point fetching = Metrics::Clock::now();
+    ResponsePointer chunk = std::make_shared<Response>();
+    chunk->id = job->request.id;
+    Sqlite_wrapper &cursor = **job->connection;
+    bool binary = job->request.flags & Request::Binary;
+    cursor.setInterruption(job->deadline, &job->cancelled);
+    if (binary ? cursor.fetch(job->rows, stream_chunk) : cursor.fetch(&ConnectionHandler::appendRow, &job->chunk))
+        chunk->flags = Response::More;
+    Sqlite_wrapper::Interruption interruption = cursor.interruption();
+    cursor.clearInterruption();
+    if (!cursor.getLastError().empty())
+    {
+        //Rows sent before are followed by the error
+        chunk->status = Response::Error;
+        job->chunk = interruption != Sqlite_wrapper::NotInterrupted ? interruptionError(*job, interruption) : cursor.getLastError();
     }
+    else if (binary)
+    {
+        chunk->flags |= Response::Binary;
+        job->chunk = job->rows.resultToBinary();
+    }
+    chunk->payload.swap(job->chunk);
+    job->chunk.reserve(stream_chunk);
+    compress(*job, *chunk);
+    if (!(chunk->flags & Response::More))
+    {
+        job->connection.reset();
+        job->executed = Metrics::Clock::now();
+    }
+    _tracer.span("fetch", job->trace, fetching, Metrics::Clock::now(), job->statement);
+    _strand.post(boost::bind(&ConnectionHandler::sendChunk, shared_from_this(), job, chunk));
+}
+
+void ConnectionHandler::compress(const Job &job, Response &response)
+{
+    if (!(job.request.flags & Request::Compressed))
+        return;
+    Metrics::Clock::time_point compressing = Metrics::Clock::now();
+    if (_compressor.compress(job.request, response))
+        _tracer.span("compress", job.trace, compressing, Metrics::Clock::now(), std::to_string(response.payload.size()) + " bytes");
+}
+
+int ConnectionHandler::appendRow(void *chunk, int argc, char **argv, char **)
+{
+    std::string &_chunk = *static_cast<std::string *>(chunk);
+    Result::streamRowToString(_chunk, argc, argv);
+    return _chunk.size() >= stream_chunk ? 1 : 0;
+}
+
+void ConnectionHandler::sendChunk(JobPointer job, ResponsePointer chunk)
+{
+    bool finished = !(chunk->flags & Response::More);
+    if (!_socket.is_open())
+    {
+        if (!finished)
+            abortStream(job);
+        else
+            finish(job);
+        return;
+    }
+    queueWrite(chunk, job);
+    if (finished)
+        finish(job);
+    else if (pendingWriteBytes < stream_window)
+        resumeStream(job);
     else
+        pausedStreams.push_back(job);
+}
+
+void ConnectionHandler::resumeStream(JobPointer job)
+{
+    if (!_executor.postUnbounded(boost::bind(&ConnectionHandler::stream, shared_from_this(), job)))
+        abortStream(job);
+}
+
+void ConnectionHandler::abortStream(JobPointer job)
+{
+    (*job->connection)->closeCursor();
+    job->connection.reset();
+    finish(job);
+}
+
+void ConnectionHandler::complete(JobPointer job)
+{
+    finish(job);
+    queueWrite(std::make_shared<Response>(std::move(job->response)), job);
+}
+
+void ConnectionHandler::finish(JobPointer job)
+{
+    inFlight--;
+    auto found = running.find(job->request.id);
+    if (found != running.end() && found->second == job)
+        running.erase(found);
+    if (!(job->request.flags & Request::Unordered))
     {
-        std::cerr << "error: " << err.message() << std::endl;
-        _socket.close();
+        orderedRunning = false;
+        runOrdered();
     }
+    if (inFlight < max_in_flight)
+        startRead();
+}
+
+void ConnectionHandler::queueWrite(ResponsePointer response, JobPointer job)
+{
+    pendingWriteBytes += response->body().size();
+    writeQueue.push_back({response, job, Metrics::Clock::now(), Metrics::Clock::time_point()});
+    if (!writing)
+        writeNext();
+}
+
+void ConnectionHandler::writeNext()
+{
+    if (!_socket.is_open())
+    {
+        writeQueue.clear();
+        pendingWriteBytes = 0;
+        while (!pausedStreams.empty())
+        {
+            abortStream(pausedStreams.front());
+            pausedStreams.pop_front();
+        }
+        closeIfDone();
+        return;
+    }
+    writing = true;
+    if (writeQueue.front().job->trace != 0)
+        writeQueue.front().writing = Metrics::Clock::now();
+    ResponsePointer response = writeQueue.front().response;
+    writeHeader = Protocol::encodeResponseHeader(*response);
+    std::vector<boost::asio::const_buffer> buffers;
+    buffers.push_back(boost::asio::buffer(writeHeader));
+    buffers.push_back(boost::asio::buffer(response->body()));
+    boost::asio::async_write(_socket, buffers,
+                             _strand.wrap(boost::bind(&ConnectionHandler::handle_write, shared_from_this(),
+                                                      boost::asio::placeholders::error, boost::asio::placeholders::bytes_transferred)));
 }
 
 void ConnectionHandler::handle_write(const boost::system::error_code &err, size_t bytes_transferred)
 {
+    writing = false;
+    PendingWrite written = writeQueue.front();
+    pendingWriteBytes -= written.response->body().size();
+    writeQueue.pop_front();
     if (!err)
     {
-        std::cout << "Result was sent to" << _socket.remote_endpoint().address().to_string() << '\n'
-                  << "Bytes transferred " << bytes_transferred << std::endl;
-
+        if (!(written.response->flags & Response::More) && written.job->request.type == Request::Query)
+        {
+            Job &job = *written.job;
+            auto now = Metrics::Clock::now();
+            Metrics::Clock::duration phases[Metrics::phaseCount] = {};
+            if (job.started != Metrics::Clock::time_point())
+                phases[Metrics::QueueWait] = job.started - job.received;
+            if (job.executed != Metrics::Clock::time_point() && job.started != Metrics::Clock::time_point())
+                phases[Metrics::Execution] = job.executed - job.started;
+            if (job.serialized != Metrics::Clock::time_point())
+                phases[Metrics::Serialization] = job.serialized - job.executed;
+            phases[Metrics::SocketWrite] = now - written.queued;
+            phases[Metrics::Total] = now - job.received;
+            _metrics.record(job.database, job.statement, phases, written.response->status != Response::Ok);
+        }
+        if (written.job->trace != 0)
+        {
+            auto now = Metrics::Clock::now();
+            _tracer.wait("write_wait", written.job->trace, written.queued, written.writing);
+            _tracer.span("socket_write", written.job->trace, written.writing, now, std::to_string(bytes_transferred) + " bytes");
+            if (!(written.response->flags & Response::More))
+                _tracer.wait("request", written.job->trace, written.job->received, now);
+        }
+        if (Logger::enabled(Logger::Debug))
+            Logger::debug("connection", std::to_string(bytes_transferred) + " bytes sent to " + remoteAddress);
+        while (!pausedStreams.empty() && pendingWriteBytes < stream_window)
+        {
+            resumeStream(pausedStreams.front());
+            pausedStreams.pop_front();
+        }
+        if (!writeQueue.empty())
+            writeNext();
+        else
+            closeIfDone();
     }
     else
     {
-        std::cerr << "error: " << err.message() << std::endl;
+        Logger::error("connection", remoteAddress + ": " + err.message());
         _socket.close();
+        cancelRunning();
+        writeNext();
     }
 }
+
+void ConnectionHandler::closeIfDone()
+{
+    if (peerClosed && inFlight == 0 && !writing && writeQueue.empty())
+        _socket.close();
+}
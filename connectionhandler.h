@@ -3,20 +3,137 @@
 #include <boost/asio.hpp>
 #include <boost/bind.hpp>
 #include <boost/enable_shared_from_this.hpp>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <memory>
 #include <string>
-#include "sqlite_wrapper.h"
+#include <unordered_map>
+#include <vector>
+#include "compressor.h"
+#include "connectionpool.h"
+#include "databaseexecutor.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "resultcache.h"
+#include "singleflight.h"
+#include "tracer.h"
+#include "writequeue.h"
+
+//Query of a request: <query>[\x1E<param>\x1F<param>...[\x1E<param>\x1F<param>...]]
+//Each \x1E (record separator) starts a row of parameters, \x1F (unit separator) divides values of a row.
+//Several rows run the query as a batch inside of one transaction.
+//Requests are framed as described in protocol.h and can be pipelined on one connection.
 
 class ConnectionHandler : public boost::enable_shared_from_this<ConnectionHandler>
 {
+public:
+    //Parts of the server shared by all connections
+    struct Services
+    {
+        ConnectionPool &pool;
+        DatabaseExecutor &executor;
+        WriteQueue &writes;
+        SingleFlight &flights;
+        Metrics &metrics;
+        ResultCache *cache;//nullptr if results are not cached
+        Tracer &tracer;
+        const std::string &traceFile;//Trace is written to it when a Trace request stops tracing
+        std::chrono::milliseconds queryTimeout;//Time limit of requests without the Timeout flag, 0 - none
+        bool queueByClient;//Queries wait in a queue of the executor per client address instead of per database
+        Compressor &compressor;
+    };
 private:
+    struct Job
+    {
+        Request request;
+        Response response;
+        std::unique_ptr<PooledConnection> connection;//Held between chunks of a streamed result
+        std::string chunk;
+        Result rows;//Rows of a chunk of a Binary streamed result
+        std::vector<std::vector<std::string>> parameters;//Taken out of the query once, a read may run again
+        bool parametersTaken = false;
+        std::string database;//Normalized name and shape of the statement for metrics
+        std::string statement;
+        Metrics::Clock::time_point received, started, executed, serialized;//Unset phases are not recorded
+        uint64_t trace = 0;//Id of the request in the trace, 0 if it isn't traced
+        Metrics::Clock::time_point read, decoding;//Set while tracing is on
+        std::chrono::milliseconds timeout{0};//0 - no limit
+        Metrics::Clock::time_point deadline = Metrics::Clock::time_point::max();
+        std::atomic<bool> cancelled{false};//Set by a Cancel request or when the client closes the connection
+    };
+    using JobPointer = std::shared_ptr<Job>;
+    using ResponsePointer = std::shared_ptr<Response>;
+    struct PendingWrite
+    {
+        ResponsePointer response;
+        JobPointer job;//Metrics of the job are recorded once its last response is written
+        Metrics::Clock::time_point queued;
+        Metrics::Clock::time_point writing;
+    };
     boost::asio::ip::tcp::socket _socket;
-    enum {message_length = 1024};
-    std::string data;
-    std::string queryResult;
-    ConnectionHandler(boost::asio::io_service &service);
+    boost::asio::io_service::strand _strand;
+    enum {read_chunk = 64 * 1024, max_in_flight = 128};
+    //Streamed results are cut into stream_chunk sized frames. Reading rows pauses while
+    //more than stream_window bytes wait to be written to the socket
+    enum {stream_chunk = 64 * 1024, stream_window = 256 * 1024};
+    std::vector<char> data;
+    std::size_t dataLength;
+    std::string remoteAddress;
+    ConnectionPool &_pool;
+    DatabaseExecutor &_executor;
+    WriteQueue &_writes;
+    SingleFlight &_flights;
+    Metrics &_metrics;
+    ResultCache *_cache;
+    Tracer &_tracer;
+    const std::string &_traceFile;
+    Metrics::Clock::time_point lastRead;//Time the last read completed, set while tracing is on
+    std::chrono::milliseconds _queryTimeout;
+    bool _queueByClient;
+    Compressor &_compressor;
+    //Members below are touched only on the strand
+    std::deque<JobPointer> ordered;//Ordered requests waiting for the previous one to finish
+    bool orderedRunning;
+    std::deque<PendingWrite> writeQueue;
+    std::string writeHeader;//Header of the response being written
+    std::size_t pendingWriteBytes;
+    std::deque<JobPointer> pausedStreams;
+    std::unordered_map<uint32_t, JobPointer> running;//Query requests by id until their last response is queued
+    bool writing;
+    bool reading;
+    bool peerClosed;//Client finished sending, connection is closed once pending responses are written
+    unsigned int inFlight;
+    ConnectionHandler(boost::asio::io_service &service, const Services &services);
+    static std::vector<std::vector<std::string>> takeParameters(std::string &query);
+    void startRead();
+    bool parseFrames();
+    void dispatch(JobPointer job);
+    void trace(JobPointer job);
+    //Runs on a database thread, formatting and writing a large trace would stall the network thread
+    void writeTrace(JobPointer job);
+    void cancel(JobPointer job);
+    void cancelRunning();
+    //Error of a query interrupted by its deadline or cancellation, empty if it wasn't
+    static std::string interruptionError(const Job &job, Sqlite_wrapper::Interruption interruption);
+    void runOrdered();
+    void post(JobPointer job);
+    void execute(JobPointer job);//Runs on a DatabaseExecutor thread
+    void write(JobPointer job, std::vector<std::vector<std::string>> &parameters);
+    void stream(JobPointer job);//Runs on a DatabaseExecutor thread
+    void compress(const Job &job, Response &response);//Runs on a DatabaseExecutor thread
+    static int appendRow(void *chunk, int argc, char **argv, char **azColName);
+    void sendChunk(JobPointer job, ResponsePointer chunk);
+    void resumeStream(JobPointer job);
+    void abortStream(JobPointer job);
+    void complete(JobPointer job);
+    void finish(JobPointer job);
+    void queueWrite(ResponsePointer response, JobPointer job);
+    void writeNext();
+    void closeIfDone();
 public:
     using pointer = boost::shared_ptr<ConnectionHandler>;
-    static pointer create(boost::asio::io_service &service);
+    static pointer create(boost::asio::io_service &service, const Services &services);
     boost::asio::ip::tcp::socket &socket();
     void start();
     void handle_read(const boost::system::error_code& err, size_t bytes_received);
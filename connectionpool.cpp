@@ -0,0 +1,309 @@
+#include "connectionpool.h"
+#include "logger.h"
+#include <vector>
+
+ConnectionPoolException::ConnectionPoolException(const std::string &databaseName, const std::string &msg)
+{
+    _msg = "Connection pool error on database ";
+    _msg += databaseName;
+    _msg += ": ";
+    _msg += msg;
+}
+
+const char *ConnectionPoolException::what() const noexcept
+{
+    return _msg.c_str();
+}
+
+PooledConnection::PooledConnection(ConnectionPool *pool, const std::string &databaseName, Sqlite_wrapper *connection, bool reader) :
+    _pool(pool), _databaseName(databaseName), _connection(connection), _reader(reader), _broken(false)
+{
+
+}
+
+PooledConnection::PooledConnection(PooledConnection &&other) :
+    _pool(other._pool), _databaseName(std::move(other._databaseName)), _connection(other._connection), _reader(other._reader),
+    _broken(other._broken)
+{
+    other._connection = nullptr;
+}
+
+PooledConnection &PooledConnection::operator =(PooledConnection &&other)
+{
+    if (this != &other)
+    {
+        release();
+        _pool = other._pool;
+        _databaseName = std::move(other._databaseName);
+        _connection = other._connection;
+        _reader = other._reader;
+        _broken = other._broken;
+        other._connection = nullptr;
+    }
+    return *this;
+}
+
+Sqlite_wrapper *PooledConnection::operator ->() const
+{
+    return _connection;
+}
+
+Sqlite_wrapper &PooledConnection::operator *() const
+{
+    return *_connection;
+}
+
+Sqlite_wrapper *PooledConnection::get() const
+{
+    return _connection;
+}
+
+void PooledConnection::setBroken()
+{
+    _broken = true;
+}
+
+void PooledConnection::release()
+{
+    if (_connection == nullptr)
+        return;
+    _pool->_release(_databaseName, _connection, _reader, _broken);
+    _connection = nullptr;
+}
+
+PooledConnection::~PooledConnection()
+{
+    release();
+}
+
+ConnectionPool::ConnectionPool() : ConnectionPool(Settings())
+{
+
+}
+
+ConnectionPool::ConnectionPool(const Settings &settings) : _settings(settings), _lastEviction(Clock::now())
+{
+    if (_settings.maxSize == 0)
+        _settings.maxSize = 1;
+    if (_settings.maxWriters == 0)
+        _settings.maxWriters = 1;
+    if (_settings.minSize > _settings.maxSize)
+        _settings.minSize = _settings.maxSize;
+}
+
+std::string ConnectionPool::normalizedName(const std::string &databaseName)
+{
+    //Sqlite_wrapper opens "name" and "name.db" as the same file
+    if (databaseName.length() >= 3 && databaseName.compare(databaseName.length() - 3, 3, ".db") == 0)
+        return databaseName;
+    return databaseName + ".db";
+}
+
+bool ConnectionPool::isValidName(const std::string &databaseName)
+{
+    return !databaseName.empty() && databaseName.find_first_of(std::string("/\\\0", 3)) == std::string::npos
+            && databaseName.find("..") == std::string::npos;
+}
+
+Sqlite_wrapper *ConnectionPool::_open(const std::string &databaseName, bool readOnly)
+{
+    std::string name = normalizedName(databaseName);
+    std::string path = _settings.directory.empty() ? name : _settings.directory + '/' + name;
+    Sqlite_wrapper *connection = Sqlite_wrapper::connectToDatabase(path, readOnly, _settings.profiles.profileOf(name));
+    if (connection == nullptr)
+        throw ConnectionPoolException(databaseName, "Couldn't open database");
+    //Read-write connection is opened once per database, readers come and go with the load
+    if (!readOnly)
+        Logger::info("pool", name + " opened with " + DatabaseProfiles::effective(*connection));
+    else if (Logger::enabled(Logger::Debug))
+        Logger::debug("pool", name + " opened read-only with " + DatabaseProfiles::effective(*connection));
+    connection->setStatementCacheSize(_settings.statementCacheSize);
+    return connection;
+}
+
+void ConnectionPool::_close(Sqlite_wrapper *connection)
+{
+    delete connection;
+}
+
+void ConnectionPool::_prefill(const std::string &databaseName, Database &database, bool readOnly, std::unique_lock<std::mutex> &guard)
+{
+    //Slots are reserved under the lock, connections are opened without it
+    unsigned int minSize = readOnly ? _settings.minSize : 1;
+    unsigned int missing = minSize > database.total ? minSize - database.total : 0;
+    if (missing == 0)
+        return;
+    database.total += missing;
+    guard.unlock();
+    std::vector<Sqlite_wrapper *> opened;
+    for (unsigned int i = 0; i < missing; i++)
+    {
+        try {
+            opened.push_back(_open(databaseName, readOnly));
+        } catch (ConnectionPoolException &) {
+            break;
+        }
+    }
+    guard.lock();
+    database.total -= missing - opened.size();
+    _statistics.opened += opened.size();
+    auto now = Clock::now();
+    for (auto connection : opened)
+        database.idle.push_front({connection, now});
+    if (!opened.empty())
+        database.available.notify_all();
+}
+
+PooledConnection ConnectionPool::acquire(const std::string &databaseName)
+{
+    return _acquire(databaseName, false);
+}
+
+PooledConnection ConnectionPool::acquireReader(const std::string &databaseName)
+{
+    return _acquire(databaseName, true);
+}
+
+PooledConnection ConnectionPool::_acquire(const std::string &databaseName, bool readOnly)
+{
+    if (!isValidName(databaseName))
+        throw ConnectionPoolException(databaseName, "Invalid database name");
+    std::string name = normalizedName(databaseName);
+    unsigned int maxSize = readOnly ? _settings.maxSize : _settings.maxWriters;
+    std::unique_lock<std::mutex> guard(_lock);
+    //File and its WAL mode are created by the read-write connection which is kept open afterwards
+    if (readOnly && _databases[name].total == 0)
+        _prefill(databaseName, _databases[name], false, guard);
+    Database &database = (readOnly ? _readers : _databases)[name];
+    if (database.total == 0)
+        _prefill(databaseName, database, readOnly, guard);
+    auto deadline = Clock::now() + _settings.acquireTimeout;
+    bool waited = false;
+    while (true)
+    {
+        while (!database.idle.empty())
+        {
+            IdleConnection idle = database.idle.back();
+            database.idle.pop_back();
+            if (Clock::now() - idle.lastUsed < _settings.healthCheckInterval)
+            {
+                _statistics.reused++;
+                return PooledConnection(this, name, idle.connection, readOnly);
+            }
+            guard.unlock();
+            bool healthy = idle.connection->checkConnection();
+            if (!healthy)
+                _close(idle.connection);
+            guard.lock();
+            if (healthy)
+            {
+                _statistics.reused++;
+                return PooledConnection(this, name, idle.connection, readOnly);
+            }
+            database.total--;
+            _statistics.closed++;
+            _statistics.failedHealthChecks++;
+        }
+        if (database.total < maxSize)
+        {
+            database.total++;
+            guard.unlock();
+            Sqlite_wrapper *connection = nullptr;
+            try {
+                connection = _open(databaseName, readOnly);
+            } catch (ConnectionPoolException &) {
+                guard.lock();
+                database.total--;
+                database.available.notify_one();
+                throw;
+            }
+            guard.lock();
+            _statistics.opened++;
+            return PooledConnection(this, name, connection, readOnly);
+        }
+        if (!waited)
+        {
+            _statistics.waited++;
+            waited = true;
+        }
+        if (database.available.wait_until(guard, deadline) == std::cv_status::timeout && database.idle.empty()
+                && database.total >= maxSize)
+            throw ConnectionPoolException(databaseName, "No free connection within acquire timeout");
+    }
+}
+
+void ConnectionPool::_release(const std::string &databaseName, Sqlite_wrapper *connection, bool reader, bool broken)
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    Database &database = (reader ? _readers : _databases)[databaseName];
+    if (broken)
+    {
+        database.total--;
+        _statistics.closed++;
+        guard.unlock();
+        _close(connection);
+        guard.lock();
+    }
+    else
+        database.idle.push_back({connection, Clock::now()});
+    database.available.notify_one();
+    bool evictionDue = Clock::now() - _lastEviction >= _settings.idleTimeout;
+    guard.unlock();
+    if (evictionDue)
+        evictIdle();
+}
+
+void ConnectionPool::evictIdle()
+{
+    std::vector<Sqlite_wrapper *> expired;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        auto now = Clock::now();
+        _lastEviction = now;
+        for (auto databases : {&_databases, &_readers})
+        {
+            unsigned int minSize = databases == &_readers ? _settings.minSize : 1;
+            for (auto &i : *databases)
+            {
+                Database &database = i.second;
+                //Least recently used connections are at the front
+                while (!database.idle.empty() && database.total > minSize
+                       && now - database.idle.front().lastUsed >= _settings.idleTimeout)
+                {
+                    expired.push_back(database.idle.front().connection);
+                    database.idle.pop_front();
+                    database.total--;
+                    _statistics.closed++;
+                }
+            }
+        }
+    }
+    for (auto connection : expired)
+        _close(connection);
+}
+
+const ConnectionPool::Settings &ConnectionPool::settings() const
+{
+    return _settings;
+}
+
+ConnectionPool::Statistics ConnectionPool::statistics()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _statistics;
+}
+
+ConnectionPool::~ConnectionPool()
+{
+    //All PooledConnection objects must be released before the pool is destroyed
+    std::lock_guard<std::mutex> guard(_lock);
+    for (auto databases : {&_databases, &_readers})
+    {
+        for (auto &i : *databases)
+        {
+            for (auto &idle : i.second.idle)
+                _close(idle.connection);
+            i.second.idle.clear();
+        }
+    }
+}
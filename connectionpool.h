@@ -0,0 +1,116 @@
+#ifndef CONNECTIONPOOL_H
+#define CONNECTIONPOOL_H
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <map>
+#include <mutex>
+#include <string>
+
+#include "databaseprofiles.h"
+#include "sqlite_wrapper.h"
+
+class ConnectionPoolException : public std::exception
+{
+    std::string _msg;
+public:
+    ConnectionPoolException(const std::string &databaseName, const std::string &msg);
+    virtual const char *what() const noexcept;
+};
+
+class ConnectionPool;
+
+//Connection borrowed from the pool. Goes back to the pool when destroyed.
+class PooledConnection
+{
+    ConnectionPool *_pool;
+    std::string _databaseName;
+    Sqlite_wrapper *_connection;
+    bool _reader;//Taken from the read-only connections, the file itself may be writable or not
+    bool _broken;
+public:
+    PooledConnection(ConnectionPool *pool, const std::string &databaseName, Sqlite_wrapper *connection, bool reader);
+    PooledConnection(const PooledConnection &other) = delete;
+    PooledConnection(PooledConnection &&other);
+    PooledConnection &operator = (const PooledConnection &other) = delete;
+    PooledConnection &operator = (PooledConnection &&other);
+    Sqlite_wrapper *operator -> () const;
+    Sqlite_wrapper &operator * () const;
+    Sqlite_wrapper *get() const;
+    //Connection will be closed instead of being returned to the pool
+    void setBroken();
+    void release();
+    ~PooledConnection();
+};
+
+class ConnectionPool
+{
+public:
+    struct Settings
+    {
+        unsigned int minSize = 1;//Read-only connections kept open per database even when idle
+        unsigned int maxSize = 8;//Upper bound of open read-only connections per database
+        unsigned int maxWriters = 1;//Upper bound of open read-write connections per database. One is always kept open
+        std::chrono::seconds idleTimeout = std::chrono::seconds(300);//Idle connections above minSize are closed after this time
+        std::chrono::seconds healthCheckInterval = std::chrono::seconds(30);//Idle connections older than this are checked before reuse
+        std::chrono::milliseconds acquireTimeout = std::chrono::milliseconds(10000);
+        unsigned int statementCacheSize = 128;//Prepared statements kept by each connection
+        DatabaseProfiles profiles;//Open flags and PRAGMAs of new connections by database name
+        std::string directory;//Database files are kept here, empty - the working directory
+    };
+    struct Statistics
+    {
+        unsigned long long opened = 0;
+        unsigned long long closed = 0;
+        unsigned long long reused = 0;
+        unsigned long long waited = 0;
+        unsigned long long failedHealthChecks = 0;
+    };
+private:
+    using Clock = std::chrono::steady_clock;
+    struct IdleConnection
+    {
+        Sqlite_wrapper *connection;
+        Clock::time_point lastUsed;
+    };
+    struct Database
+    {
+        std::deque<IdleConnection> idle;//Most recently used connection is at the back
+        unsigned int total = 0;
+        std::condition_variable available;
+    };
+    Settings _settings;
+    Statistics _statistics;
+    std::map<std::string, Database> _databases;//Read-write connections
+    std::map<std::string, Database> _readers;//Read-only connections
+    std::mutex _lock;
+    Clock::time_point _lastEviction;
+    Sqlite_wrapper *_open(const std::string &databaseName, bool readOnly);
+    void _close(Sqlite_wrapper *connection);
+    void _prefill(const std::string &databaseName, Database &database, bool readOnly, std::unique_lock<std::mutex> &guard);
+    PooledConnection _acquire(const std::string &databaseName, bool readOnly);
+    void _release(const std::string &databaseName, Sqlite_wrapper *connection, bool reader, bool broken);
+    friend class PooledConnection;
+public:
+    ConnectionPool();
+    explicit ConnectionPool(const Settings &settings);
+    ConnectionPool(const ConnectionPool &other) = delete;
+    ConnectionPool &operator = (const ConnectionPool &other) = delete;
+    //Throws ConnectionPoolException if the name isn't valid, connection can't be opened or none became free within acquireTimeout
+    PooledConnection acquire(const std::string &databaseName);
+    //Read-only connection. In WAL mode readers run concurrently with the writer of the database
+    PooledConnection acquireReader(const std::string &databaseName);
+    //Name under which the file of databaseName is kept, e.g. "test" and "test.db" are the same database
+    static std::string normalizedName(const std::string &databaseName);
+    //Names come from clients, so a name which could reach a file outside of the directory is refused:
+    //empty ones and those with '/', '\', ".." or a NUL character
+    static bool isValidName(const std::string &databaseName);
+    //Closes connections idle longer than idleTimeout while keeping minSize per database
+    void evictIdle();
+    const Settings &settings() const;
+    Statistics statistics();
+    ~ConnectionPool();
+};
+
+#endif // CONNECTIONPOOL_H
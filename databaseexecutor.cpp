@@ -0,0 +1,241 @@
+#include "databaseexecutor.h"
+#include <algorithm>
+#include <exception>
+#include "logger.h"
+
+DatabaseExecutor::DatabaseExecutor(unsigned int threads, unsigned int queueSize) : _queueSize(queueSize), _queued(0), _stopped(false)
+{
+    if (threads == 0)
+        threads = 1;
+    _workers.reserve(threads);
+    for (unsigned int i = 0; i < threads; i++)
+        _workers.emplace_back(&DatabaseExecutor::_work, this);
+}
+
+DatabaseExecutor::Queue *DatabaseExecutor::_take(std::function<void()> &task, int64_t &charge)
+{
+    //Every turn of a queue which may run a task adds to its deficit, so the loop ends
+    //once some queue saved up for its next task. Queues at their thread limit are passed over
+    while (true)
+    {
+        bool runnable = false;
+        for (std::size_t i = 0, n = _active.size(); i < n; i++)
+        {
+            Queue &queue = *_active.front();
+            unsigned int maxRunning = queue.limits.maxRunning != 0 ? queue.limits.maxRunning : _workers.size();
+            if (queue.running < maxRunning)
+            {
+                runnable = true;
+                if (queue.deficit >= queue.cost)
+                {
+                    task = std::move(queue.tasks.front());
+                    queue.tasks.pop_front();
+                    _queued--;
+                    queue.running++;
+                    charge = queue.cost;
+                    queue.deficit -= charge;
+                    if (queue.tasks.empty())
+                    {
+                        //Idle queues don't save up, debts of slow tasks are kept
+                        queue.active = false;
+                        queue.deficit = std::min<int64_t>(queue.deficit, 0);
+                        _active.pop_front();
+                    }
+                    return &queue;
+                }
+                queue.deficit += static_cast<int64_t>(std::max(queue.limits.weight, 1u)) * quantum;
+            }
+            _active.splice(_active.end(), _active, _active.begin());
+        }
+        if (!runnable)
+            return nullptr;
+    }
+}
+
+void DatabaseExecutor::_work()
+{
+    while (true)
+    {
+        std::function<void()> task;
+        Queue *queue = nullptr;
+        int64_t charge = 0;
+        {
+            std::unique_lock<std::mutex> guard(_lock);
+            _available.wait(guard, [&] {
+                if (!_unbounded.empty())
+                    return true;
+                queue = _take(task, charge);
+                return queue != nullptr || (_stopped && _queued == 0);
+            });
+            if (queue == nullptr)
+            {
+                if (_unbounded.empty())
+                    return;
+                task = std::move(_unbounded.front());
+                _unbounded.pop_front();
+            }
+        }
+        Clock::time_point started = Clock::now();
+        //A task which throws loses its own work only, the thread and the accounting of its queue go on
+        try
+        {
+            task();
+        }
+        catch (const std::exception &e)
+        {
+            Logger::error("executor", std::string("Task failed: ") + e.what());
+        }
+        catch (...)
+        {
+            Logger::error("executor", "Task failed with an unknown exception");
+        }
+        if (queue == nullptr)
+            continue;
+        int64_t took = std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - started).count();
+        took = std::min<int64_t>(std::max<int64_t>(took, 1), maxCost);
+        bool waiting;
+        {
+            std::lock_guard<std::mutex> guard(_lock);
+            queue->running--;
+            queue->deficit += charge - took;
+            queue->cost += (took - queue->cost) / 8;
+            queue->cost = std::max<int64_t>(queue->cost, 1);
+            waiting = !queue->tasks.empty();
+        }
+        //Task of a queue at its thread limit may be runnable now
+        if (waiting)
+            _available.notify_one();
+    }
+}
+
+unsigned int DatabaseExecutor::_maxQueued(const Queue &queue) const
+{
+    return queue.limits.maxQueued != 0 ? queue.limits.maxQueued : _queueSize;
+}
+
+void DatabaseExecutor::_forgetIdle()
+{
+    if (_queues.size() <= maxIdleQueues)
+        return;
+    for (auto i = _queues.begin(); i != _queues.end();)
+    {
+        const Queue &queue = i->second;
+        if (!queue.configured && !queue.active && queue.running == 0 && queue.deficit >= 0)
+            i = _queues.erase(i);
+        else
+            ++i;
+    }
+}
+
+bool DatabaseExecutor::post(const std::string &queueName, std::function<void()> task, std::chrono::milliseconds *retryAfter)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_stopped)
+        {
+            if (retryAfter != nullptr)
+                *retryAfter = std::chrono::milliseconds(0);
+            return false;
+        }
+        auto found = _queues.find(queueName);
+        if (found == _queues.end())
+        {
+            _forgetIdle();
+            found = _queues.emplace(queueName, Queue()).first;
+            found->second.limits = _defaultLimits;
+        }
+        Queue &queue = found->second;
+        if (queue.tasks.size() >= _maxQueued(queue))
+        {
+            queue.rejected++;
+            if (retryAfter != nullptr)
+            {
+                //Time for the threads the queue may use to get through a tenth of it
+                unsigned int threads = queue.limits.maxRunning != 0 ? std::min<unsigned int>(queue.limits.maxRunning, _workers.size()) : _workers.size();
+                int64_t microseconds = queue.cost * static_cast<int64_t>(queue.tasks.size() / 10 + 1) / std::max(threads, 1u);
+                *retryAfter = std::chrono::milliseconds(std::max<int64_t>(microseconds / 1000, 1));
+            }
+            return false;
+        }
+        queue.tasks.push_back(std::move(task));
+        queue.admitted++;
+        _queued++;
+        if (!queue.active)
+        {
+            queue.active = true;
+            _active.push_back(&queue);
+        }
+    }
+    _available.notify_one();
+    return true;
+}
+
+bool DatabaseExecutor::postUnbounded(std::function<void()> task)
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        if (_stopped)
+            return false;
+        _unbounded.push_back(std::move(task));
+    }
+    _available.notify_one();
+    return true;
+}
+
+void DatabaseExecutor::setDefaultLimits(const Limits &limits)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _defaultLimits = limits;
+    for (auto &i : _queues)
+    {
+        if (!i.second.configured)
+            i.second.limits = limits;
+    }
+}
+
+void DatabaseExecutor::setLimits(const std::string &queue, const Limits &limits)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    Queue &configured = _queues[queue];
+    configured.limits = limits;
+    configured.configured = true;
+}
+
+unsigned int DatabaseExecutor::threads() const
+{
+    return _workers.size();
+}
+
+unsigned int DatabaseExecutor::queued()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _queued + _unbounded.size();
+}
+
+std::map<std::string, DatabaseExecutor::QueueStatistics> DatabaseExecutor::queueStatistics()
+{
+    std::map<std::string, QueueStatistics> statistics;
+    std::lock_guard<std::mutex> guard(_lock);
+    for (auto &i : _queues)
+        statistics[i.first] = {static_cast<unsigned int>(i.second.tasks.size()), i.second.running, i.second.admitted, i.second.rejected};
+    return statistics;
+}
+
+void DatabaseExecutor::stop()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopped = true;
+    }
+    _available.notify_all();
+    for (auto &i : _workers)
+    {
+        if (i.joinable())
+            i.join();
+    }
+}
+
+DatabaseExecutor::~DatabaseExecutor()
+{
+    stop();
+}
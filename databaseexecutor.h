@@ -0,0 +1,90 @@
+#ifndef DATABASEEXECUTOR_H
+#define DATABASEEXECUTOR_H
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+//Fixed set of threads which run SQLite work away from the network threads.
+//Tasks wait in named queues, e.g. one per database, and threads take them by deficit round robin:
+//every turn adds weight * quantum microseconds to the deficit of a queue and a task costs the time
+//tasks of its queue took on average. The real time of a task is charged once it is over, so a queue
+//of slow queries gets its share of thread time, not a share of tasks. Queues are bounded and may be
+//limited to a number of threads, so a flood of one tenant doesn't hold every thread.
+//Exceptions thrown by a task are logged and don't stop its thread.
+class DatabaseExecutor
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    struct Limits
+    {
+        unsigned int weight = 1;
+        unsigned int maxRunning = 0;//Threads running tasks of the queue at once, 0 - all of them
+        unsigned int maxQueued = 0;//Tasks waiting in the queue above this are rejected, 0 - the queue size of the executor
+    };
+    struct QueueStatistics
+    {
+        unsigned int queued;
+        unsigned int running;
+        unsigned long long admitted;
+        unsigned long long rejected;
+    };
+    enum {quantum = 1000, maxCost = 100 * quantum};//Microseconds
+private:
+    struct Queue
+    {
+        std::deque<std::function<void()>> tasks;
+        Limits limits;
+        bool configured = false;//Limits were set, the queue is kept while idle
+        bool active = false;//Has tasks and is in _active
+        unsigned int running = 0;
+        int64_t deficit = 0;
+        int64_t cost = quantum;//Average microseconds of its tasks
+        unsigned long long admitted = 0;
+        unsigned long long rejected = 0;
+    };
+    enum {maxIdleQueues = 1024};//Idle queues without own limits above this are forgotten
+    std::vector<std::thread> _workers;
+    std::deque<std::function<void()>> _unbounded;//Run before queued tasks
+    std::unordered_map<std::string, Queue> _queues;
+    std::list<Queue *> _active;//Queues with tasks in round robin order, the current one is at the front
+    std::mutex _lock;
+    std::condition_variable _available;
+    unsigned int _queueSize;
+    Limits _defaultLimits;
+    unsigned int _queued;
+    bool _stopped;
+    void _work();
+    //Takes the next task of the queues and charges its queue. Returns nullptr if no queue may run one now
+    Queue *_take(std::function<void()> &task, int64_t &charge);
+    unsigned int _maxQueued(const Queue &queue) const;
+    void _forgetIdle();
+public:
+    DatabaseExecutor(unsigned int threads, unsigned int queueSize);
+    DatabaseExecutor(const DatabaseExecutor &other) = delete;
+    DatabaseExecutor &operator = (const DatabaseExecutor &other) = delete;
+    //Returns false if the queue is full or executor was stopped. Task is not run in this case, retryAfter
+    //is set to the time the queue needs to get shorter if it is given
+    bool post(const std::string &queue, std::function<void()> task, std::chrono::milliseconds *retryAfter = nullptr);
+    //Ignores queues and their limits. For work which already holds resources and has to go on, e.g. a paused result stream
+    bool postUnbounded(std::function<void()> task);
+    //Limits of queues which don't have their own
+    void setDefaultLimits(const Limits &limits);
+    void setLimits(const std::string &queue, const Limits &limits);
+    unsigned int threads() const;
+    unsigned int queued();
+    std::map<std::string, QueueStatistics> queueStatistics();
+    //Runs tasks which are already queued and joins the threads
+    void stop();
+    ~DatabaseExecutor();
+};
+
+#endif // DATABASEEXECUTOR_H
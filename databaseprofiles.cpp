@@ -0,0 +1,184 @@
+#include "databaseprofiles.h"
+#include <fnmatch.h>
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+
+const char *const DatabaseProfiles::pragmaNames[pragmaCount] = {"page_size", "mmap_size", "cache_size", "synchronous",
+                                                                 "temp_store", "journal_size_limit", "locking_mode"};
+
+namespace
+{
+std::string trimmed(const std::string &text)
+{
+    std::size_t begin = text.find_first_not_of(" \t\r");
+    if (begin == std::string::npos)
+        return std::string();
+    return text.substr(begin, text.find_last_not_of(" \t\r") - begin + 1);
+}
+
+std::string lowered(std::string text)
+{
+    std::transform(text.begin(), text.end(), text.begin(), [](unsigned char c) { return std::tolower(c); });
+    return text;
+}
+
+bool isInteger(const std::string &value)
+{
+    std::size_t digits = value.compare(0, 1, "-") == 0 ? 1 : 0;
+    return value.size() > digits && value.size() <= 20
+            && std::all_of(value.begin() + digits, value.end(), [](unsigned char c) { return std::isdigit(c); });
+}
+}
+
+std::string DatabaseProfiles::_normalized(const std::string &pattern)
+{
+    //Same as ConnectionPool::normalizedName for names, patterns may match the suffix themselves
+    if (pattern.find_first_of("*?[") != std::string::npos
+            || (pattern.length() >= 3 && pattern.compare(pattern.length() - 3, 3, ".db") == 0))
+        return pattern;
+    return pattern + ".db";
+}
+
+std::string DatabaseProfiles::_checkPragma(const std::string &name, const std::string &value)
+{
+    //Values end up in the text of a PRAGMA statement, so only numbers and known keywords are let through
+    static const std::vector<std::pair<std::string, std::vector<std::string>>> keywords = {
+        {"synchronous", {"off", "normal", "full", "extra", "0", "1", "2", "3"}},
+        {"temp_store", {"default", "file", "memory", "0", "1", "2"}},
+        {"locking_mode", {"normal", "exclusive"}}};
+    if (std::find_if(pragmaNames, pragmaNames + pragmaCount, [&](const char *known) { return name == known; })
+            == pragmaNames + pragmaCount)
+        return "Unknown setting " + name;
+    for (auto &allowed : keywords)
+    {
+        if (allowed.first != name)
+            continue;
+        if (std::find(allowed.second.begin(), allowed.second.end(), value) == allowed.second.end())
+            return "Value " + value + " is not allowed for " + name;
+        return std::string();
+    }
+    if (!isInteger(value))
+        return name + " needs a number, not " + value;
+    return std::string();
+}
+
+std::string DatabaseProfiles::_parseFlags(const std::string &value, int &flags)
+{
+    static const std::vector<std::pair<std::string, int>> known = {
+        {"nofollow", SQLITE_OPEN_NOFOLLOW}, {"exrescode", SQLITE_OPEN_EXRESCODE},
+        {"shared_cache", SQLITE_OPEN_SHAREDCACHE}, {"private_cache", SQLITE_OPEN_PRIVATECACHE}};
+    std::string flag;
+    for (std::size_t i = 0; i <= value.size(); i++)
+    {
+        if (i < value.size() && value[i] != ' ' && value[i] != '\t' && value[i] != ',')
+        {
+            flag += value[i];
+            continue;
+        }
+        if (flag.empty())
+            continue;
+        auto found = std::find_if(known.begin(), known.end(), [&](const std::pair<std::string, int> &item) { return item.first == flag; });
+        if (found == known.end())
+            return "Unknown open flag " + flag;
+        flags |= found->second;
+        flag.clear();
+    }
+    if ((flags & SQLITE_OPEN_SHAREDCACHE) && (flags & SQLITE_OPEN_PRIVATECACHE))
+        return "shared_cache and private_cache can't be used together";
+    return std::string();
+}
+
+bool DatabaseProfiles::load(const std::string &path, std::string &error)
+{
+    std::ifstream file(path);
+    if (!file)
+    {
+        error = path + " couldn't be opened";
+        return false;
+    }
+    std::vector<Section> sections;
+    std::string line;
+    for (unsigned int number = 1; std::getline(file, line); number++)
+    {
+        std::string problem;
+        std::size_t comment = line.find('#');
+        line = trimmed(line.substr(0, comment));
+        if (line.empty())
+            continue;
+        if (line.front() == '[')
+        {
+            std::string pattern = line.back() == ']' ? trimmed(line.substr(1, line.size() - 2)) : std::string();
+            if (pattern.empty())
+                problem = "Section needs a database name or pattern in brackets";
+            else
+                sections.push_back({_normalized(pattern), Sqlite_wrapper::OpenProfile()});
+        }
+        else if (sections.empty())
+            problem = "Setting is outside of a section";
+        else
+        {
+            std::size_t separator = line.find('=');
+            std::string name = lowered(trimmed(line.substr(0, separator)));
+            std::string value = separator != std::string::npos ? lowered(trimmed(line.substr(separator + 1))) : std::string();
+            Sqlite_wrapper::OpenProfile &profile = sections.back().profile;
+            if (separator == std::string::npos || value.empty())
+                problem = "Setting needs a value: name = value";
+            else if (name == "open_flags")
+                problem = _parseFlags(value, profile.flags);
+            else if ((problem = _checkPragma(name, value)).empty())
+            {
+                auto set = std::find_if(profile.pragmas.begin(), profile.pragmas.end(),
+                                        [&](const std::pair<std::string, std::string> &pragma) { return pragma.first == name; });
+                if (set != profile.pragmas.end())
+                    set->second = value;
+                else
+                    profile.pragmas.emplace_back(name, value);
+            }
+        }
+        if (!problem.empty())
+        {
+            error = path + ":" + std::to_string(number) + ": " + problem;
+            return false;
+        }
+    }
+    _sections.swap(sections);
+    return true;
+}
+
+bool DatabaseProfiles::empty() const
+{
+    return _sections.empty();
+}
+
+Sqlite_wrapper::OpenProfile DatabaseProfiles::profileOf(const std::string &databaseName) const
+{
+    Sqlite_wrapper::OpenProfile merged;
+    for (auto &section : _sections)
+    {
+        if (fnmatch(section.pattern.c_str(), databaseName.c_str(), 0) != 0)
+            continue;
+        merged.flags |= section.profile.flags;
+        for (auto &pragma : section.profile.pragmas)
+        {
+            auto set = std::find_if(merged.pragmas.begin(), merged.pragmas.end(),
+                                    [&](const std::pair<std::string, std::string> &item) { return item.first == pragma.first; });
+            if (set != merged.pragmas.end())
+                set->second = pragma.second;
+            else
+                merged.pragmas.push_back(pragma);
+        }
+    }
+    //page_size goes first, the others don't depend on the order
+    std::stable_partition(merged.pragmas.begin(), merged.pragmas.end(),
+                          [](const std::pair<std::string, std::string> &pragma) { return pragma.first == "page_size"; });
+    return merged;
+}
+
+std::string DatabaseProfiles::effective(Sqlite_wrapper &connection)
+{
+    std::string settings;
+    for (const char *name : pragmaNames)
+        settings += (settings.empty() ? "" : ", ") + std::string(name) + "=" + connection.pragma(name);
+    return settings;
+}
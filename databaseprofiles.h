@@ -0,0 +1,49 @@
+#ifndef DATABASEPROFILES_H
+#define DATABASEPROFILES_H
+#include <string>
+#include <vector>
+
+#include "sqlite_wrapper.h"
+
+//Open flags and PRAGMAs of connections by database name, read from a file like
+//
+//  # Comments start with #
+//  [*]
+//  cache_size = -16384
+//  [archive_*.db]
+//  mmap_size = 1073741824
+//  temp_store = memory
+//  [ingest]
+//  synchronous = normal
+//  journal_size_limit = 67108864
+//  open_flags = nofollow exrescode
+//
+//Sections are shell patterns of database names with their .db suffix, a name without wildcards gets it
+//added. Every section matching a database applies in the order of the file, so later ones override
+//earlier ones. Keys are the PRAGMAs in pragmaNames and open_flags: nofollow, exrescode, shared_cache, private_cache.
+class DatabaseProfiles
+{
+public:
+    static const char *const pragmaNames[];
+    enum {pragmaCount = 7};
+private:
+    struct Section
+    {
+        std::string pattern;
+        Sqlite_wrapper::OpenProfile profile;
+    };
+    std::vector<Section> _sections;
+    static std::string _normalized(const std::string &pattern);
+    //Empty if value may be given to the PRAGMA, otherwise why it may not
+    static std::string _checkPragma(const std::string &name, const std::string &value);
+    static std::string _parseFlags(const std::string &value, int &flags);
+public:
+    //Replaces the profiles with the ones of the file. Returns false and sets error, with the line it is on, if it can't
+    bool load(const std::string &path, std::string &error);
+    bool empty() const;
+    Sqlite_wrapper::OpenProfile profileOf(const std::string &databaseName) const;
+    //"name=value, ..." of the PRAGMAs in pragmaNames as connection reports them, whether a profile set them or not
+    static std::string effective(Sqlite_wrapper &connection);
+};
+
+#endif // DATABASEPROFILES_H
@@ -0,0 +1,29 @@
+#ifndef JSON_H
+#define JSON_H
+#include <cstdio>
+#include <string>
+
+//Appends value as a quoted JSON string: quotes and backslashes are escaped, control characters become \uXXXX
+inline void appendJsonString(std::string &out, const std::string &value)
+{
+    out += '"';
+    for (char c : value)
+    {
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        }
+        else
+            out += c;
+    }
+    out += '"';
+}
+
+#endif // JSON_H
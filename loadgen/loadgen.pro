@@ -0,0 +1,48 @@
+TEMPLATE = app
+TARGET = loadgen
+CONFIG += console c++17 thread release
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+LIBS += -lsqlite3 -lboost_system -lpthread -lz
+
+SOURCES += \
+        main.cpp \
+        ../arena.cpp \
+        ../compressor.cpp \
+        ../connectionhandler.cpp \
+        ../connectionpool.cpp \
+        ../databaseexecutor.cpp \
+        ../databaseprofiles.cpp \
+        ../logger.cpp \
+        ../metrics.cpp \
+        ../protocol.cpp \
+        ../result.cpp \
+        ../resultcache.cpp \
+        ../server.cpp \
+        ../singleflight.cpp \
+        ../sqlite_wrapper.cpp \
+        ../statementcache.cpp \
+        ../tracer.cpp \
+        ../writequeue.cpp
+
+HEADERS += \
+        ../arena.h \
+        ../compressor.h \
+        ../connectionhandler.h \
+        ../connectionpool.h \
+        ../databaseexecutor.h \
+        ../databaseprofiles.h \
+        ../json.h \
+        ../logger.h \
+        ../metrics.h \
+        ../protocol.h \
+        ../result.h \
+        ../resultcache.h \
+        ../server.h \
+        ../singleflight.h \
+        ../sqlite_wrapper.h \
+        ../statementcache.h \
+        ../tracer.h \
+        ../writequeue.h
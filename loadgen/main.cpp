@@ -0,0 +1,569 @@
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "logger.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "server.h"
+
+//Open-loop load generator. Requests are sent at a fixed arrival rate whether or not earlier ones were
+//answered, and latency is measured from the time a request was due to be sent, so a stalled server
+//shows up in the percentiles instead of slowing the load down (coordinated omission).
+//Without --server a local server is started on SQLite files in a temporary directory.
+
+using namespace std;
+using boost::asio::ip::tcp;
+using Clock = chrono::steady_clock;
+
+namespace
+{
+struct Options
+{
+    double rate = 1000;//Requests per second of all connections together
+    double duration = 10;//Seconds
+    double warmup = 2;//Seconds before duration whose requests are not measured
+    double drain = 5;//Seconds responses are waited for after the last request was sent
+    unsigned int connections = 16;
+    unsigned int databases = 4;
+    unsigned int rows = 10000;
+    double readRatio = 0.9;
+    bool poisson = true;
+    bool unordered = false;
+    unsigned int threads = 2;
+    string server;//host:port, empty - local server
+    unsigned int networkThreads = 0;
+    unsigned int databaseThreads = 0;
+    bool threadPerCore = false;
+    string output;
+};
+
+struct Statistics
+{
+    Metrics::Histogram reads;
+    Metrics::Histogram writes;
+    unsigned long long sent = 0;
+    unsigned long long completed = 0;
+    unsigned long long errors = 0;
+    unsigned long long busy = 0;
+    unsigned long long late = 0;//Sent more than a millisecond after they were due
+    unsigned long long unanswered = 0;
+    void merge(const Statistics &other)
+    {
+        reads.merge(other.reads);
+        writes.merge(other.writes);
+        sent += other.sent;
+        completed += other.completed;
+        errors += other.errors;
+        busy += other.busy;
+        late += other.late;
+        unanswered += other.unanswered;
+    }
+};
+
+const char *readQuery = "select id, value, payload from t where id = ?";
+const char *writeQuery = "update t set value = value + 1 where id = ?";
+
+string databaseName(const string &directory, unsigned int index)
+{
+    return directory + "loadgen_" + to_string(index);
+}
+
+class Connection : public enable_shared_from_this<Connection>
+{
+    struct Pending
+    {
+        Clock::time_point due;
+        bool write;
+        bool measured;
+    };
+    const Options &_options;
+    const vector<string> &_databases;
+    boost::asio::io_service::strand _strand;
+    tcp::socket _socket;
+    boost::asio::steady_timer _timer;
+    mt19937_64 _random;
+    Clock::time_point _measuredFrom;
+    Clock::time_point _end;
+    Clock::time_point _next;
+    uint32_t _lastId;
+    unordered_map<uint32_t, Pending> _pending;
+    deque<string> _writeQueue;
+    bool _writing;
+    vector<char> _chunk;
+    string _received;
+    function<void()> _done;
+    bool _finished;
+    Statistics _statistics;
+
+    Clock::duration _interval()
+    {
+        double mean = _options.connections / _options.rate;
+        double seconds = _options.poisson ? exponential_distribution<double>(1 / mean)(_random) : mean;
+        return chrono::duration_cast<Clock::duration>(chrono::duration<double>(seconds));
+    }
+
+    void _schedule()
+    {
+        Clock::time_point now = Clock::now();
+        while (_next <= now && _next < _end)
+        {
+            _issue(_next, now);
+            _next += _interval();
+        }
+        if (_next >= _end)
+        {
+            _finishIfDone();
+            return;
+        }
+        auto self = shared_from_this();
+        _timer.expires_at(_next);
+        _timer.async_wait(_strand.wrap([self](const boost::system::error_code &err) {
+            if (!err)
+                self->_schedule();
+        }));
+    }
+
+    void _issue(Clock::time_point due, Clock::time_point now)
+    {
+        Request request;
+        request.id = ++_lastId;
+        request.flags = _options.unordered ? Request::Unordered : 0;
+        request.database = _databases[uniform_int_distribution<size_t>(0, _databases.size() - 1)(_random)];
+        bool write = uniform_real_distribution<double>(0, 1)(_random) >= _options.readRatio;
+        request.query = string(write ? writeQuery : readQuery) + '\x1E'
+                + to_string(uniform_int_distribution<unsigned int>(1, _options.rows)(_random));
+        _pending[request.id] = {due, write, due >= _measuredFrom};
+        _statistics.sent++;
+        if (now - due > chrono::milliseconds(1))
+            _statistics.late++;
+        _writeQueue.push_back(Protocol::encodeRequest(request));
+        if (!_writing)
+            _writeNext();
+    }
+
+    void _writeNext()
+    {
+        if (_writeQueue.empty())
+        {
+            _writing = false;
+            return;
+        }
+        _writing = true;
+        auto self = shared_from_this();
+        boost::asio::async_write(_socket, boost::asio::buffer(_writeQueue.front()),
+                                 _strand.wrap([self](const boost::system::error_code &err, size_t) {
+            self->_writeQueue.pop_front();
+            if (err)
+                self->_close();
+            else
+                self->_writeNext();
+        }));
+    }
+
+    void _read()
+    {
+        auto self = shared_from_this();
+        _socket.async_read_some(boost::asio::buffer(_chunk), _strand.wrap([self](const boost::system::error_code &err, size_t bytes) {
+            if (err)
+            {
+                self->_close();
+                return;
+            }
+            self->_received.append(self->_chunk.data(), bytes);
+            if (!self->_parse())
+            {
+                self->_close();
+                return;
+            }
+            self->_finishIfDone();
+            if (!self->_finished)
+                self->_read();
+        }));
+    }
+
+    bool _parse()
+    {
+        Clock::time_point now = Clock::now();
+        size_t position = 0;
+        while (_received.size() - position >= Protocol::lengthSize)
+        {
+            uint32_t length = Protocol::getUint32(_received.data() + position);
+            if (_received.size() - position - Protocol::lengthSize < length)
+                break;
+            Response response;
+            if (!Protocol::decodeResponse(_received.data() + position + Protocol::lengthSize, length, response))
+                return false;
+            position += Protocol::lengthSize + length;
+            auto found = _pending.find(response.id);
+            if (found == _pending.end() || (response.flags & Response::More))
+                continue;
+            _statistics.completed++;
+            if (response.status == Response::Error)
+                _statistics.errors++;
+            else if (response.status == Response::Busy)
+                _statistics.busy++;
+            if (found->second.measured)
+            {
+                uint64_t microseconds = chrono::duration_cast<chrono::microseconds>(now - found->second.due).count();
+                (found->second.write ? _statistics.writes : _statistics.reads).record(microseconds);
+            }
+            _pending.erase(found);
+        }
+        _received.erase(0, position);
+        return true;
+    }
+
+    void _finishIfDone()
+    {
+        if (!_finished && _next >= _end && _pending.empty())
+            _close();
+    }
+
+    void _close()
+    {
+        if (_finished)
+            return;
+        _finished = true;
+        _statistics.unanswered += _pending.size();
+        _pending.clear();
+        boost::system::error_code ignored;
+        _timer.cancel(ignored);
+        _socket.close(ignored);
+        _done();
+    }
+public:
+    Connection(boost::asio::io_service &service, const Options &options, const vector<string> &databases, uint64_t seed) :
+        _options(options),
+        _databases(databases),
+        _strand(service),
+        _socket(service),
+        _timer(service),
+        _random(seed),
+        _lastId(0),
+        _writing(false),
+        _chunk(64 * 1024),
+        _finished(false)
+    {
+
+    }
+    //done is called once the connection was closed, its statistics are final then
+    void start(const tcp::endpoint &endpoint, Clock::time_point start, function<void()> done)
+    {
+        _done = move(done);
+        _measuredFrom = start + chrono::duration_cast<Clock::duration>(chrono::duration<double>(_options.warmup));
+        _end = _measuredFrom + chrono::duration_cast<Clock::duration>(chrono::duration<double>(_options.duration));
+        //Connections start at different offsets so that fixed rate arrivals don't come in bursts
+        _next = start + chrono::duration_cast<Clock::duration>(
+                    chrono::duration<double>(uniform_real_distribution<double>(0, _options.connections / _options.rate)(_random)));
+        _socket.connect(endpoint);
+        _socket.set_option(tcp::no_delay(true));
+        auto self = shared_from_this();
+        _strand.dispatch([self] {
+            self->_read();
+            self->_schedule();
+        });
+    }
+    //Closes the connection, requests still waiting for responses are counted as unanswered
+    void abort()
+    {
+        auto self = shared_from_this();
+        _strand.dispatch([self] { self->_close(); });
+    }
+    const Statistics &statistics() const
+    {
+        return _statistics;
+    }
+};
+
+//Blocking request used to set databases up before the load starts
+bool execute(tcp::socket &socket, const string &database, const string &query)
+{
+    Request request;
+    request.id = 1;
+    request.database = database;
+    request.query = query;
+    boost::asio::write(socket, boost::asio::buffer(Protocol::encodeRequest(request)));
+    char length[Protocol::lengthSize];
+    boost::asio::read(socket, boost::asio::buffer(length));
+    string frame(Protocol::getUint32(length), '\0');
+    boost::asio::read(socket, boost::asio::buffer(&frame[0], frame.size()));
+    Response response;
+    if (!Protocol::decodeResponse(frame.data(), frame.size(), response) || response.status != Response::Ok)
+    {
+        cerr << "Setup of " << database << " failed on \"" << query << "\": " << response.payload << endl;
+        return false;
+    }
+    return true;
+}
+
+bool populate(const tcp::endpoint &endpoint, const vector<string> &databases, unsigned int rows)
+{
+    boost::asio::io_service service;
+    tcp::socket socket(service);
+    socket.connect(endpoint);
+    for (auto &database : databases)
+    {
+        if (!execute(socket, database, "drop table if exists t")
+                || !execute(socket, database, "create table t (id integer primary key, value integer, payload text)")
+                || !execute(socket, database, "with recursive n(x) as (select 1 union all select x + 1 from n limit "
+                            + to_string(rows) + ") insert into t select x, x, hex(randomblob(32)) from n"))
+            return false;
+    }
+    return true;
+}
+
+void printLatencies(const char *name, const Metrics::Histogram &histogram)
+{
+    if (histogram.count() == 0)
+    {
+        printf("%-8s %10s\n", name, "-");
+        return;
+    }
+    printf("%-8s %10llu %10llu %10llu %10llu %10llu %10llu\n", name,
+           static_cast<unsigned long long>(histogram.percentile(0.5)), static_cast<unsigned long long>(histogram.percentile(0.9)),
+           static_cast<unsigned long long>(histogram.percentile(0.99)), static_cast<unsigned long long>(histogram.percentile(0.999)),
+           static_cast<unsigned long long>(histogram.max()), static_cast<unsigned long long>(histogram.sum() / histogram.count()));
+}
+
+string latenciesJson(const Metrics::Histogram &histogram)
+{
+    string json = "{\"count\": " + to_string(histogram.count());
+    if (histogram.count() != 0)
+    {
+        json += ", \"p50\": " + to_string(histogram.percentile(0.5)) + ", \"p90\": " + to_string(histogram.percentile(0.9))
+                + ", \"p99\": " + to_string(histogram.percentile(0.99)) + ", \"p999\": " + to_string(histogram.percentile(0.999))
+                + ", \"max\": " + to_string(histogram.max()) + ", \"mean\": " + to_string(histogram.sum() / histogram.count());
+    }
+    return json + "}";
+}
+
+void report(const Options &options, const Statistics &statistics, double elapsed)
+{
+    Metrics::Histogram all = statistics.reads;
+    all.merge(statistics.writes);
+    double throughput = all.count() / options.duration;
+    printf("Target %.0f requests/s, measured %.1f/s over %.1f s after %.1f s of warm up (%.1f s in total)\n",
+           options.rate, throughput, options.duration, options.warmup, elapsed);
+    printf("%u connections, %u databases of %u rows, %.0f%% reads, %s arrivals\n", options.connections, options.databases,
+           options.rows, options.readRatio * 100, options.poisson ? "poisson" : "fixed rate");
+    printf("Requests: %llu sent, %llu answered, %llu errors, %llu busy, %llu unanswered, %llu sent late\n",
+           statistics.sent, statistics.completed, statistics.errors, statistics.busy, statistics.unanswered, statistics.late);
+    printf("Latency in microseconds from the time a request was due:\n");
+    printf("%-8s %10s %10s %10s %10s %10s %10s\n", "", "p50", "p90", "p99", "p99.9", "max", "mean");
+    printLatencies("all", all);
+    printLatencies("reads", statistics.reads);
+    printLatencies("writes", statistics.writes);
+    if (options.output.empty())
+        return;
+    ofstream file(options.output, ios::trunc);
+    file << "{\"rate\": " << options.rate << ", \"duration_s\": " << options.duration << ", \"warmup_s\": " << options.warmup
+         << ", \"connections\": " << options.connections << ", \"databases\": " << options.databases << ", \"rows\": " << options.rows
+         << ", \"read_ratio\": " << options.readRatio << ", \"arrivals\": \"" << (options.poisson ? "poisson" : "fixed") << "\""
+         << ", \"throughput\": " << throughput << ", \"sent\": " << statistics.sent << ", \"answered\": " << statistics.completed
+         << ", \"errors\": " << statistics.errors << ", \"busy\": " << statistics.busy << ", \"unanswered\": " << statistics.unanswered
+         << ", \"late\": " << statistics.late << ",\n \"latency_us\": {\"all\": " << latenciesJson(all)
+         << ", \"reads\": " << latenciesJson(statistics.reads) << ", \"writes\": " << latenciesJson(statistics.writes) << "}}\n";
+    if (!file)
+        cerr << "Results couldn't be written to " << options.output << endl;
+}
+
+void printUsage(const char *program)
+{
+    cout << "Usage: " << program << " [options]\n"
+         << "  --rate <n>                requests per second of all connections (default 1000)\n"
+         << "  --duration <sec>          measured time (default 10)\n"
+         << "  --warmup <sec>            time before the measured one (default 2)\n"
+         << "  --drain <sec>             time responses are waited for after the last request (default 5)\n"
+         << "  --connections <n>         connections sending requests (default 16)\n"
+         << "  --databases <n>           databases requests are spread over (default 4)\n"
+         << "  --rows <n>                rows of the table of every database (default 10000)\n"
+         << "  --read-ratio <fraction>   share of reads, the rest are updates (default 0.9)\n"
+         << "  --arrivals <kind>         poisson or fixed (default poisson)\n"
+         << "  --unordered <0|1>         send requests with the Unordered flag (default 0)\n"
+         << "  --threads <n>             threads of the load generator (default 2)\n"
+         << "  --server <host:port>      server to load, databases are created relative to its directory\n"
+         << "                            (default: a local server on a temporary directory)\n"
+         << "  --network-threads <n>     network threads of the local server (default: hardware threads)\n"
+         << "  --database-threads <n>    database threads of the local server (default: hardware threads)\n"
+         << "  --thread-per-core <0|1>   local server runs a pinned io_service and acceptor per network thread (default 0)\n"
+         << "  --output <path>           JSON file with the results (default: none)" << endl;
+}
+
+bool parseOptions(int argc, char *argv[], Options &options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (i + 1 >= argc)
+            return false;
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(option, "--rate") == 0)
+            options.rate = atof(value);
+        else if (strcmp(option, "--duration") == 0)
+            options.duration = atof(value);
+        else if (strcmp(option, "--warmup") == 0)
+            options.warmup = atof(value);
+        else if (strcmp(option, "--drain") == 0)
+            options.drain = atof(value);
+        else if (strcmp(option, "--connections") == 0)
+            options.connections = atoi(value);
+        else if (strcmp(option, "--databases") == 0)
+            options.databases = atoi(value);
+        else if (strcmp(option, "--rows") == 0)
+            options.rows = atoi(value);
+        else if (strcmp(option, "--read-ratio") == 0)
+            options.readRatio = atof(value);
+        else if (strcmp(option, "--arrivals") == 0 && (strcmp(value, "poisson") == 0 || strcmp(value, "fixed") == 0))
+            options.poisson = strcmp(value, "poisson") == 0;
+        else if (strcmp(option, "--unordered") == 0)
+            options.unordered = atoi(value) != 0;
+        else if (strcmp(option, "--threads") == 0)
+            options.threads = atoi(value);
+        else if (strcmp(option, "--server") == 0)
+            options.server = value;
+        else if (strcmp(option, "--network-threads") == 0)
+            options.networkThreads = atoi(value);
+        else if (strcmp(option, "--database-threads") == 0)
+            options.databaseThreads = atoi(value);
+        else if (strcmp(option, "--thread-per-core") == 0)
+            options.threadPerCore = atoi(value) != 0;
+        else if (strcmp(option, "--output") == 0)
+            options.output = value;
+        else
+            return false;
+    }
+    return options.rate > 0 && options.duration > 0 && options.warmup >= 0 && options.connections > 0
+            && options.databases > 0 && options.rows > 0 && options.threads > 0;
+}
+}
+
+int main(int argc, char *argv[])
+{
+    Options options;
+    if ((argc == 2 && strcmp(argv[1], "--help") == 0) || !parseOptions(argc, argv, options))
+    {
+        printUsage(argv[0]);
+        return argc == 2 && strcmp(argv[1], "--help") == 0 ? 0 : 1;
+    }
+    Logger::setLevel(Logger::Warning);
+    unique_ptr<Server> server;
+    thread serverThread;
+    string directory;
+    tcp::endpoint endpoint;
+    try {
+        if (options.server.empty())
+        {
+            char temporary[] = "/tmp/loadgen_XXXXXX";
+            if (mkdtemp(temporary) == nullptr)
+            {
+                cerr << "Temporary directory couldn't be created" << endl;
+                return 1;
+            }
+            directory = string(temporary) + "/";
+            Server::Settings settings;
+            settings.address = "127.0.0.1";
+            settings.port = 0;
+            settings.networkThreads = options.networkThreads;
+            settings.databaseThreads = options.databaseThreads;
+            settings.threadPerCore = options.threadPerCore;
+            server.reset(new Server(settings));
+            endpoint = tcp::endpoint(boost::asio::ip::address::from_string(settings.address), server->port());
+            serverThread = thread([&server] { server->run(); });
+        }
+        else
+        {
+            auto colon = options.server.rfind(':');
+            if (colon == string::npos)
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            endpoint = tcp::endpoint(boost::asio::ip::address::from_string(options.server.substr(0, colon)),
+                                     static_cast<unsigned short>(atoi(options.server.c_str() + colon + 1)));
+        }
+    } catch (exception &e) {
+        cerr << "Server couldn't be started: " << e.what() << endl;
+        return 1;
+    }
+
+    int status = 0;
+    try {
+        vector<string> databases;
+        for (unsigned int i = 0; i < options.databases; i++)
+            databases.push_back(databaseName(directory, i));
+        if (!populate(endpoint, databases, options.rows))
+            throw runtime_error("databases couldn't be set up");
+
+        boost::asio::io_service service;
+        vector<shared_ptr<Connection>> connections;
+        mutex lock;
+        condition_variable closed;
+        unsigned int open = options.connections;
+        for (unsigned int i = 0; i < options.connections; i++)
+            connections.push_back(make_shared<Connection>(service, options, databases, random_device()() + i));
+        Clock::time_point start = Clock::now();
+        for (auto &connection : connections)
+        {
+            connection->start(endpoint, start, [&] {
+                lock_guard<mutex> guard(lock);
+                if (--open == 0)
+                    closed.notify_all();
+            });
+        }
+        vector<thread> threads;
+        auto work = make_shared<boost::asio::io_service::work>(service);
+        for (unsigned int i = 0; i < options.threads; i++)
+            threads.emplace_back([&service] { service.run(); });
+        Clock::time_point deadline = start + chrono::duration_cast<Clock::duration>(
+                    chrono::duration<double>(options.warmup + options.duration + options.drain));
+        {
+            unique_lock<mutex> guard(lock);
+            if (!closed.wait_until(guard, deadline, [&open] { return open == 0; }))
+            {
+                guard.unlock();
+                for (auto &connection : connections)
+                    connection->abort();
+                guard.lock();
+                closed.wait(guard, [&open] { return open == 0; });
+            }
+        }
+        double elapsed = chrono::duration<double>(Clock::now() - start).count();
+        work.reset();
+        service.stop();
+        for (auto &i : threads)
+            i.join();
+        Statistics statistics;
+        for (auto &connection : connections)
+            statistics.merge(connection->statistics());
+        report(options, statistics, elapsed);
+    } catch (exception &e) {
+        cerr << "Load failed: " << e.what() << endl;
+        status = 1;
+    }
+
+    if (server)
+    {
+        server->stop();
+        serverThread.join();
+        server.reset();
+        error_code ignored;
+        filesystem::remove_all(directory, ignored);
+    }
+    return status;
+}
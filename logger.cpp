@@ -0,0 +1,247 @@
+#include "logger.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+
+namespace
+{
+struct RingOwner
+{
+    std::atomic<bool> *closed = nullptr;
+    ~RingOwner()
+    {
+        if (closed != nullptr)
+            closed->store(true, std::memory_order_release);
+    }
+};
+
+struct ErrorLimit
+{
+    const char *component;
+    int64_t second;
+    unsigned int count;
+    unsigned long long suppressed;
+};
+
+int64_t now()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+}
+
+Logger::Logger() : _level(Info), _lastThread(0), _stopped(false), _out(&std::cerr)
+{
+    _flusher = std::thread(&Logger::_run, this);
+}
+
+Logger::~Logger()
+{
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _stopped = true;
+    }
+    _wake.notify_one();
+    _flusher.join();
+    _flush();
+}
+
+Logger &Logger::_instance()
+{
+    static Logger logger;
+    return logger;
+}
+
+Logger::Ring &Logger::_ring()
+{
+    thread_local Ring *ring = nullptr;
+    thread_local RingOwner owner;
+    if (ring == nullptr)
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _rings.emplace_back(new Ring());
+        ring = _rings.back().get();
+        ring->thread = ++_lastThread;
+        owner.closed = &ring->closed;
+    }
+    return *ring;
+}
+
+void Logger::_put(Level level, const char *component, const char *text, std::size_t length)
+{
+    Ring &ring = _ring();
+    uint64_t head = ring.head.load(std::memory_order_relaxed);
+    if (head - ring.tail.load(std::memory_order_acquire) >= ringSize)
+    {
+        ring.dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record &record = ring.records[head % ringSize];
+    record.time = now();
+    record.level = level;
+    record.component = component;
+    record.length = static_cast<uint16_t>(std::min<std::size_t>(length, textSize));
+    std::memcpy(record.text, text, record.length);
+    if (length > textSize)
+        std::memcpy(record.text + textSize - 3, "...", 3);
+    ring.head.store(head + 1, std::memory_order_release);
+}
+
+void Logger::_write(Level level, const char *component, const std::string &message)
+{
+    if (level >= Warning)
+    {
+        thread_local std::vector<ErrorLimit> limits;
+        int64_t second = now() / 1000000000;
+        auto limit = std::find_if(limits.begin(), limits.end(), [component](const ErrorLimit &i) { return i.component == component; });
+        if (limit == limits.end())
+            limit = limits.insert(limits.end(), {component, second, 0, 0});
+        if (limit->second != second)
+        {
+            if (limit->suppressed != 0)
+            {
+                std::string note = std::to_string(limit->suppressed) + " similar messages were suppressed";
+                _put(level, component, note.data(), note.size());
+            }
+            *limit = {component, second, 0, 0};
+        }
+        if (++limit->count > errorBurst)
+        {
+            limit->suppressed++;
+            return;
+        }
+    }
+    _put(level, component, message.data(), message.size());
+}
+
+void Logger::_flush()
+{
+    static const char *levels[] = {"DEBUG", "INFO", "WARNING", "ERROR"};
+    struct Line
+    {
+        const Record *record;
+        unsigned int thread;
+    };
+    std::lock_guard<std::mutex> guard(_lock);
+    std::vector<Line> lines;
+    std::string out;
+    std::vector<std::pair<Ring *, uint64_t>> taken;
+    for (auto &i : _rings)
+    {
+        uint64_t tail = i->tail.load(std::memory_order_relaxed), head = i->head.load(std::memory_order_acquire);
+        for (uint64_t j = tail; j != head; j++)
+            lines.push_back({&i->records[j % ringSize], i->thread});
+        taken.emplace_back(i.get(), head);
+        unsigned long long dropped = i->dropped.exchange(0, std::memory_order_relaxed);
+        if (dropped != 0)
+            out += std::to_string(dropped) + " log records of thread " + std::to_string(i->thread) + " were dropped, its log ring was full\n";
+    }
+    //Records of different threads are written in the order they were made
+    std::stable_sort(lines.begin(), lines.end(), [](const Line &a, const Line &b) { return a.record->time < b.record->time; });
+    for (auto &i : lines)
+    {
+        std::time_t seconds = static_cast<std::time_t>(i.record->time / 1000000000);
+        std::tm time;
+        gmtime_r(&seconds, &time);
+        char stamp[48];
+        std::size_t length = std::strftime(stamp, sizeof(stamp), "%Y-%m-%d %H:%M:%S", &time);
+        std::snprintf(stamp + length, sizeof(stamp) - length, ".%06d ", static_cast<int>(i.record->time % 1000000000 / 1000));
+        out += stamp;
+        out += levels[i.record->level];
+        out += " [" + std::to_string(i.thread) + "] ";
+        out += i.record->component;
+        out += ": ";
+        out.append(i.record->text, i.record->length);
+        out += '\n';
+    }
+    //Slots are given back to their threads only after they were formatted
+    for (auto &i : taken)
+        i.first->tail.store(i.second, std::memory_order_release);
+    _rings.erase(std::remove_if(_rings.begin(), _rings.end(), [](const std::unique_ptr<Ring> &ring) {
+        return ring->closed.load(std::memory_order_acquire)
+                && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed);
+    }), _rings.end());
+    if (!out.empty())
+    {
+        _out->write(out.data(), static_cast<std::streamsize>(out.size()));
+        _out->flush();
+    }
+}
+
+void Logger::_run()
+{
+    std::unique_lock<std::mutex> guard(_lock);
+    while (!_stopped)
+    {
+        _wake.wait_for(guard, std::chrono::milliseconds(flushIntervalMs));
+        guard.unlock();
+        _flush();
+        guard.lock();
+    }
+}
+
+void Logger::setLevel(Level level)
+{
+    _instance()._level.store(level, std::memory_order_relaxed);
+}
+
+bool Logger::enabled(Level level)
+{
+    return level >= _instance()._level.load(std::memory_order_relaxed) && level != Off;
+}
+
+bool Logger::parseLevel(const std::string &name, Level &level)
+{
+    static const char *names[] = {"debug", "info", "warning", "error", "off"};
+    for (uint8_t i = Debug; i <= Off; i++)
+    {
+        if (name == names[i])
+        {
+            level = static_cast<Level>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Logger::setFile(const std::string &path)
+{
+    Logger &logger = _instance();
+    logger._flush();
+    std::lock_guard<std::mutex> guard(logger._lock);
+    logger._file.open(path, std::ios::app);
+    logger._out = logger._file.is_open() ? static_cast<std::ostream *>(&logger._file) : &std::cerr;
+    return logger._file.is_open();
+}
+
+void Logger::write(Level level, const char *component, const std::string &message)
+{
+    if (enabled(level))
+        _instance()._write(level, component, message);
+}
+
+void Logger::debug(const char *component, const std::string &message)
+{
+    write(Debug, component, message);
+}
+
+void Logger::info(const char *component, const std::string &message)
+{
+    write(Info, component, message);
+}
+
+void Logger::warning(const char *component, const std::string &message)
+{
+    write(Warning, component, message);
+}
+
+void Logger::error(const char *component, const std::string &message)
+{
+    write(Error, component, message);
+}
+
+void Logger::flush()
+{
+    _instance()._flush();
+}
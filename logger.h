@@ -0,0 +1,76 @@
+#ifndef LOGGER_H
+#define LOGGER_H
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//Asynchronous logger. Every thread puts records into its own lock-free ring and a background thread
+//writes them out in batches, so threads never wait for the output stream. Records which don't fit
+//into a full ring are dropped and counted. Warnings and errors of a component are limited to
+//errorBurst per second on every thread, the number of suppressed ones is logged with the next one.
+class Logger
+{
+public:
+    enum Level : uint8_t {Debug, Info, Warning, Error, Off};
+private:
+    enum {ringSize = 1024, textSize = 400, errorBurst = 20, flushIntervalMs = 50};
+    struct Record
+    {
+        int64_t time;//Nanoseconds since epoch
+        Level level;
+        const char *component;
+        uint16_t length;
+        char text[textSize];
+    };
+    //Single producer, single consumer: the owning thread moves head, the flusher moves tail
+    struct Ring
+    {
+        Record records[ringSize];
+        std::atomic<uint64_t> head{0};
+        std::atomic<uint64_t> tail{0};
+        std::atomic<uint64_t> dropped{0};
+        std::atomic<bool> closed{false};//Owning thread exited, ring is removed once it is empty
+        unsigned int thread;
+    };
+    std::atomic<uint8_t> _level;
+    std::vector<std::unique_ptr<Ring>> _rings;
+    unsigned int _lastThread;
+    std::mutex _lock;//Guards rings list and output
+    std::condition_variable _wake;
+    bool _stopped;
+    std::ofstream _file;
+    std::ostream *_out;
+    std::thread _flusher;
+    Logger();
+    ~Logger();
+    static Logger &_instance();
+    Ring &_ring();
+    void _put(Level level, const char *component, const char *text, std::size_t length);
+    void _write(Level level, const char *component, const std::string &message);
+    void _flush();
+    void _run();
+public:
+    Logger(const Logger &other) = delete;
+    Logger &operator = (const Logger &other) = delete;
+    static void setLevel(Level level);
+    static bool enabled(Level level);
+    //"debug", "info", "warning", "error" or "off"
+    static bool parseLevel(const std::string &name, Level &level);
+    //Records are appended to the file instead of stderr. Returns false if the file can't be opened
+    static bool setFile(const std::string &path);
+    static void write(Level level, const char *component, const std::string &message);
+    static void debug(const char *component, const std::string &message);
+    static void info(const char *component, const std::string &message);
+    static void warning(const char *component, const std::string &message);
+    static void error(const char *component, const std::string &message);
+    //Writes out records logged so far
+    static void flush();
+};
+
+#endif // LOGGER_H
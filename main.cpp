@@ -1,9 +1,175 @@
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "logger.h"
+#include "server.h"
 
 using namespace std;
 
-int main()
+//"<name>=<weight>[:<max running>[:<max queued>]]"
+static bool parseQueue(const char *value, Server::Settings &settings)
 {
-    cout << "Hello World!" << endl;
+    const char *separator = strrchr(value, '=');
+    if (separator == nullptr || separator == value)
+        return false;
+    DatabaseExecutor::Limits limits;
+    int fields = sscanf(separator + 1, "%u:%u:%u", &limits.weight, &limits.maxRunning, &limits.maxQueued);
+    if (fields < 1 || limits.weight == 0)
+        return false;
+    settings.queues[string(value, separator)] = limits;
+    return true;
+}
+
+static void printUsage(const char *program)
+{
+    cout << "Usage: " << program << " [options]\n"
+         << "  --address <ip>              address to listen on (default 0.0.0.0)\n"
+         << "  --port <port>               port to listen on (default 5555)\n"
+         << "  --network-threads <n>       threads running socket I/O (default: hardware threads)\n"
+         << "  --thread-per-core <0|1>     own io_service and SO_REUSEPORT acceptor per network thread, pinned to a core (default 0)\n"
+         << "  --database-threads <n>      threads running SQLite queries (default: hardware threads)\n"
+         << "  --database-queue <n>        queries allowed to wait in one queue for a database thread (default 1024)\n"
+         << "  --queue-by <database|client> queries of one database or one client address share a queue (default database)\n"
+         << "  --queue-max-running <n>     database threads one queue may use at once, 0 - all (default 0)\n"
+         << "  --queue <name>=<weight>[:<max running>[:<max queued>]]\n"
+         << "                              share of database thread time and limits of one queue, may be repeated\n"
+         << "  --query-timeout <ms>        time limit of requests which don't set their own, 0 - none (default 30000)\n"
+         << "  --pool-min <n>              read-only connections kept open per database (default 1)\n"
+         << "  --pool-max <n>              read-only connections allowed per database (default: database threads)\n"
+         << "  --pool-idle-timeout <sec>   idle time after which extra connections are closed (default 300)\n"
+         << "  --data-directory <path>     directory of the database files, names with '/', '\\' or '..' are refused (default: working directory)\n"
+         << "  --database-profiles <path>  file of open flags and PRAGMAs by database name, see databaseprofiles.h (default: none)\n"
+         << "  --statement-cache <n>       prepared statements kept per connection (default 128)\n"
+         << "  --write-batch <n>           writes committed by one transaction at most (default 256)\n"
+         << "  --write-batch-time <ms>     time after which a batch of writes is committed (default 20)\n"
+         << "  --compression-threshold <bytes> responses shorter than this are sent uncompressed (default 4096)\n"
+         << "  --result-cache <MB>         memory for cached results of read queries (default 0 - disabled)\n"
+         << "  --metrics-file <path>       file to write metrics to periodically (default: none)\n"
+         << "  --metrics-interval <sec>    time between writes of the metrics file (default 60)\n"
+         << "  --trace-sample <n>          trace every n-th request from the start (default 0 - until a Trace request)\n"
+         << "  --trace-file <path>         file the trace is written to (default trace.json)\n"
+         << "  --log-level <level>         debug, info, warning, error or off (default info)\n"
+         << "  --log-file <path>           file to append the log to (default: stderr)" << endl;
+}
+
+int main(int argc, char *argv[])
+{
+    Server::Settings settings;
+    settings.pool.maxSize = 0;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--help") == 0)
+        {
+            printUsage(argv[0]);
+            return 0;
+        }
+        if (i + 1 >= argc)
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+        const char *option = argv[i];
+        const char *value = argv[++i];
+        if (strcmp(option, "--address") == 0)
+            settings.address = value;
+        else if (strcmp(option, "--port") == 0)
+            settings.port = static_cast<unsigned short>(atoi(value));
+        else if (strcmp(option, "--network-threads") == 0)
+            settings.networkThreads = atoi(value);
+        else if (strcmp(option, "--thread-per-core") == 0)
+            settings.threadPerCore = atoi(value) != 0;
+        else if (strcmp(option, "--database-threads") == 0)
+            settings.databaseThreads = atoi(value);
+        else if (strcmp(option, "--database-queue") == 0)
+            settings.databaseQueueSize = atoi(value);
+        else if (strcmp(option, "--queue-by") == 0)
+        {
+            if (strcmp(value, "database") != 0 && strcmp(value, "client") != 0)
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            settings.queueByClient = strcmp(value, "client") == 0;
+        }
+        else if (strcmp(option, "--queue-max-running") == 0)
+            settings.queueLimits.maxRunning = atoi(value);
+        else if (strcmp(option, "--queue") == 0)
+        {
+            if (!parseQueue(value, settings))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (strcmp(option, "--query-timeout") == 0)
+            settings.queryTimeout = std::chrono::milliseconds(atoi(value));
+        else if (strcmp(option, "--pool-min") == 0)
+            settings.pool.minSize = atoi(value);
+        else if (strcmp(option, "--pool-max") == 0)
+            settings.pool.maxSize = atoi(value);
+        else if (strcmp(option, "--pool-idle-timeout") == 0)
+            settings.pool.idleTimeout = std::chrono::seconds(atoi(value));
+        else if (strcmp(option, "--data-directory") == 0)
+            settings.pool.directory = value;
+        else if (strcmp(option, "--database-profiles") == 0)
+        {
+            std::string error;
+            if (!settings.pool.profiles.load(value, error))
+            {
+                cerr << error << endl;
+                return 1;
+            }
+        }
+        else if (strcmp(option, "--statement-cache") == 0)
+            settings.pool.statementCacheSize = atoi(value);
+        else if (strcmp(option, "--write-batch") == 0)
+            settings.writes.maxBatchSize = atoi(value);
+        else if (strcmp(option, "--write-batch-time") == 0)
+            settings.writes.maxBatchTime = std::chrono::milliseconds(atoi(value));
+        else if (strcmp(option, "--compression-threshold") == 0)
+            settings.compressionThreshold = static_cast<std::size_t>(atol(value));
+        else if (strcmp(option, "--result-cache") == 0)
+            settings.resultCacheSize = static_cast<std::size_t>(atoi(value)) * 1024 * 1024;
+        else if (strcmp(option, "--metrics-file") == 0)
+            settings.metricsFile = value;
+        else if (strcmp(option, "--metrics-interval") == 0)
+            settings.metricsInterval = std::chrono::seconds(atoi(value));
+        else if (strcmp(option, "--trace-sample") == 0)
+            settings.traceSampling = atoi(value);
+        else if (strcmp(option, "--trace-file") == 0)
+            settings.traceFile = value;
+        else if (strcmp(option, "--log-level") == 0)
+        {
+            Logger::Level level;
+            if (!Logger::parseLevel(value, level))
+            {
+                printUsage(argv[0]);
+                return 1;
+            }
+            Logger::setLevel(level);
+        }
+        else if (strcmp(option, "--log-file") == 0)
+        {
+            if (!Logger::setFile(value))
+            {
+                cerr << "Log file " << value << " couldn't be opened" << endl;
+                return 1;
+            }
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    try {
+        Server server(settings);
+        server.run();
+    } catch (std::exception &e) {
+        Logger::error("server", std::string("Server error: ") + e.what());
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,272 @@
+#include "metrics.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include "json.h"
+
+unsigned int Metrics::Histogram::_index(uint64_t value)
+{
+    if (value < subBuckets)
+        return static_cast<unsigned int>(value);
+    //Bits below the highest one and the 4 following it are dropped
+    unsigned int exponent = 63 - __builtin_clzll(value);
+    unsigned int index = subBuckets + (exponent - 4) * subBuckets + ((value >> (exponent - 4)) & (subBuckets - 1));
+    return index < buckets ? index : buckets - 1;
+}
+
+uint64_t Metrics::Histogram::_upperBound(unsigned int index)
+{
+    if (index < subBuckets)
+        return index;
+    unsigned int exponent = (index - subBuckets) / subBuckets + 4;
+    uint64_t mantissa = (index - subBuckets) % subBuckets;
+    return ((subBuckets + mantissa + 1) << (exponent - 4)) - 1;
+}
+
+void Metrics::Histogram::record(uint64_t microseconds)
+{
+    _counts[_index(microseconds)]++;
+    _count++;
+    _sum += microseconds;
+    if (microseconds > _max)
+        _max = microseconds;
+}
+
+void Metrics::Histogram::merge(const Histogram &other)
+{
+    for (unsigned int i = 0; i < buckets; i++)
+        _counts[i] += other._counts[i];
+    _count += other._count;
+    _sum += other._sum;
+    if (other._max > _max)
+        _max = other._max;
+}
+
+uint64_t Metrics::Histogram::count() const
+{
+    return _count;
+}
+
+uint64_t Metrics::Histogram::sum() const
+{
+    return _sum;
+}
+
+uint64_t Metrics::Histogram::max() const
+{
+    return _max;
+}
+
+uint64_t Metrics::Histogram::percentile(double fraction) const
+{
+    if (_count == 0)
+        return 0;
+    uint64_t target = static_cast<uint64_t>(fraction * _count + 0.999999), seen = 0;
+    if (target == 0)
+        target = 1;
+    for (unsigned int i = 0; i < buckets; i++)
+    {
+        seen += _counts[i];
+        if (seen >= target)
+            return std::min(_upperBound(i), _max);
+    }
+    return _max;
+}
+
+Metrics::Metrics() : _started(Clock::now())
+{
+    static std::atomic<unsigned int> lastId(0);
+    _id = ++lastId;
+}
+
+std::string Metrics::shape(const std::string &sql)
+{
+    enum {maxLength = 256};
+    std::string shaped;
+    shaped.reserve(std::min<std::size_t>(sql.size(), maxLength));
+    auto identifier = [](char c) { return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$'; };
+    for (std::size_t i = 0, n = sql.size(); i < n && shaped.size() < maxLength; i++)
+    {
+        char c = sql[i];
+        bool wordStart = shaped.empty() || !identifier(shaped.back());
+        if (c == '\'' || ((c == 'x' || c == 'X') && wordStart && i + 1 < n && sql[i + 1] == '\''))
+        {
+            //String and blob literals, '' inside of a string is an escaped quote
+            i += c == '\'' ? 1 : 2;
+            while (i < n && !(sql[i] == '\'' && (i + 1 >= n || sql[i + 1] != '\'')))
+                i += sql[i] == '\'' ? 2 : 1;
+            shaped += '?';
+        }
+        else if (std::isdigit(static_cast<unsigned char>(c)) && wordStart)
+        {
+            while (i + 1 < n && (std::isalnum(static_cast<unsigned char>(sql[i + 1])) || sql[i + 1] == '.'))
+                i++;
+            shaped += '?';
+        }
+        else
+            shaped += c;
+    }
+    return shaped;
+}
+
+Metrics::Shard &Metrics::_shard()
+{
+    //Objects are told apart by id, as a later Metrics object could get the address of a destroyed one
+    thread_local std::vector<std::pair<unsigned int, Shard *>> shards;
+    for (auto &i : shards)
+    {
+        if (i.first == _id)
+            return *i.second;
+    }
+    std::lock_guard<std::mutex> guard(_lock);
+    _shards.emplace_back(new Shard());
+    shards.emplace_back(_id, _shards.back().get());
+    return *_shards.back();
+}
+
+void Metrics::record(const std::string &database, const std::string &statement, const Clock::duration (&phases)[phaseCount], bool error)
+{
+    Shard &shard = _shard();
+    std::string key = database;
+    key += '\0';
+    key += statement;
+    std::lock_guard<std::mutex> guard(shard.lock);
+    auto found = shard.series.find(key);
+    if (found == shard.series.end())
+    {
+        if (shard.series.size() >= maxStatements)
+        {
+            key.erase(database.size() + 1);
+            key += "<other>";
+            found = shard.series.find(key);
+        }
+        if (found == shard.series.end())
+            found = shard.series.emplace(key, std::unique_ptr<Series>(new Series())).first;
+    }
+    Series &series = *found->second;
+    for (unsigned int i = 0; i < phaseCount; i++)
+    {
+        if (phases[i] != Clock::duration::zero())
+            series.phases[i].record(std::chrono::duration_cast<std::chrono::microseconds>(phases[i]).count());
+    }
+    if (error)
+        series.errors++;
+}
+
+void Metrics::addCounters(const std::string &name, std::function<Counters()> counters)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _counters.emplace_back(name, std::move(counters));
+}
+
+static void appendPhases(std::string &out, const Metrics::Histogram (&phases)[Metrics::phaseCount], unsigned long long errors)
+{
+    static const char *names[Metrics::phaseCount] = {"queue_wait", "execution", "serialization", "socket_write", "total"};
+    out += "\"requests\":" + std::to_string(phases[Metrics::Total].count()) + ",\"errors\":" + std::to_string(errors) + ",\"phases_us\":{";
+    bool first = true;
+    for (unsigned int i = 0; i < Metrics::phaseCount; i++)
+    {
+        const Metrics::Histogram &histogram = phases[i];
+        if (histogram.count() == 0)
+            continue;
+        if (!first)
+            out += ',';
+        first = false;
+        out += '"';
+        out += names[i];
+        out += "\":{\"count\":" + std::to_string(histogram.count())
+                + ",\"mean\":" + std::to_string(histogram.sum() / histogram.count())
+                + ",\"p50\":" + std::to_string(histogram.percentile(0.5))
+                + ",\"p90\":" + std::to_string(histogram.percentile(0.9))
+                + ",\"p99\":" + std::to_string(histogram.percentile(0.99))
+                + ",\"p999\":" + std::to_string(histogram.percentile(0.999))
+                + ",\"max\":" + std::to_string(histogram.max()) + '}';
+    }
+    out += '}';
+}
+
+std::string Metrics::dump()
+{
+    struct Database
+    {
+        Series total;
+        std::map<std::string, Series> statements;
+    };
+    std::map<std::string, Database> databases;
+    std::vector<Shard *> shards;
+    std::vector<std::pair<std::string, std::function<Counters()>>> counters;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        for (auto &i : _shards)
+            shards.push_back(i.get());
+        counters = _counters;
+    }
+    for (auto shard : shards)
+    {
+        std::lock_guard<std::mutex> guard(shard->lock);
+        for (auto &i : shard->series)
+        {
+            auto separator = i.first.find('\0');
+            Database &database = databases[i.first.substr(0, separator)];
+            Series &statement = database.statements[i.first.substr(separator + 1)];
+            for (unsigned int j = 0; j < phaseCount; j++)
+            {
+                statement.phases[j].merge(i.second->phases[j]);
+                database.total.phases[j].merge(i.second->phases[j]);
+            }
+            statement.errors += i.second->errors;
+            database.total.errors += i.second->errors;
+        }
+    }
+    std::string out = "{\"uptime_s\":" + std::to_string(std::chrono::duration_cast<std::chrono::seconds>(Clock::now() - _started).count());
+    out += ",\"counters\":{";
+    for (std::size_t i = 0; i < counters.size(); i++)
+    {
+        if (i != 0)
+            out += ',';
+        appendJsonString(out, counters[i].first);
+        out += ":{";
+        Counters values = counters[i].second();
+        for (std::size_t j = 0; j < values.size(); j++)
+        {
+            if (j != 0)
+                out += ',';
+            appendJsonString(out, values[j].first);
+            out += ':' + std::to_string(values[j].second);
+        }
+        out += '}';
+    }
+    out += "},\"databases\":[";
+    bool firstDatabase = true;
+    for (auto &i : databases)
+    {
+        if (!firstDatabase)
+            out += ',';
+        firstDatabase = false;
+        out += "{\"name\":";
+        appendJsonString(out, i.first);
+        out += ',';
+        appendPhases(out, i.second.total.phases, i.second.total.errors);
+        //Statements which took the most time in total come first
+        std::vector<std::pair<const std::string, Series> *> statements;
+        for (auto &j : i.second.statements)
+            statements.push_back(&j);
+        std::sort(statements.begin(), statements.end(), [](std::pair<const std::string, Series> *a, std::pair<const std::string, Series> *b) {
+            return a->second.phases[Total].sum() > b->second.phases[Total].sum();
+        });
+        out += ",\"statements\":[";
+        for (std::size_t j = 0; j < statements.size(); j++)
+        {
+            if (j != 0)
+                out += ',';
+            out += "{\"statement\":";
+            appendJsonString(out, statements[j]->first);
+            out += ',';
+            appendPhases(out, statements[j]->second.phases, statements[j]->second.errors);
+            out += '}';
+        }
+        out += "]}";
+    }
+    out += "]}";
+    return out;
+}
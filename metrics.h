@@ -0,0 +1,76 @@
+#ifndef METRICS_H
+#define METRICS_H
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+//Latency histograms of requests per database and per statement shape.
+//Every thread records into its own shard, so recording threads don't share locks or cache lines
+//with each other. Shards are merged only when metrics are dumped.
+class Metrics
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    enum Phase : uint8_t {QueueWait, Execution, Serialization, SocketWrite, Total, phaseCount};
+    //Log-linear buckets of microseconds: exact below 16, then 16 buckets per power of two (6% precision)
+    class Histogram
+    {
+    public:
+        enum {subBuckets = 16, buckets = subBuckets + 37 * subBuckets};
+    private:
+        uint64_t _counts[buckets] = {};
+        uint64_t _count = 0;
+        uint64_t _sum = 0;
+        uint64_t _max = 0;
+        static unsigned int _index(uint64_t value);
+        static uint64_t _upperBound(unsigned int index);
+    public:
+        void record(uint64_t microseconds);
+        void merge(const Histogram &other);
+        uint64_t count() const;
+        uint64_t sum() const;
+        uint64_t max() const;
+        //Smallest value which is not exceeded by the given fraction of recorded values, e.g. 0.99
+        uint64_t percentile(double fraction) const;
+    };
+    using Counters = std::vector<std::pair<std::string, unsigned long long>>;
+    enum {maxStatements = 512};//Statement shapes tracked by a thread, others are recorded as "<other>"
+private:
+    struct Series
+    {
+        Histogram phases[phaseCount];
+        unsigned long long errors = 0;
+    };
+    struct Shard
+    {
+        std::mutex lock;//Taken by the owning thread and by dump() only
+        std::unordered_map<std::string, std::unique_ptr<Series>> series;//database \0 statement -> series
+    };
+    unsigned int _id;
+    Clock::time_point _started;
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::vector<std::pair<std::string, std::function<Counters()>>> _counters;
+    std::mutex _lock;
+    Shard &_shard();
+public:
+    Metrics();
+    Metrics(const Metrics &other) = delete;
+    Metrics &operator = (const Metrics &other) = delete;
+    //Replaces literals with ? so that statements differing in values only share their metrics
+    static std::string shape(const std::string &sql);
+    //Phases of one request. Phases which are zero were not passed by the request and are not recorded
+    void record(const std::string &database, const std::string &statement, const Clock::duration (&phases)[phaseCount], bool error);
+    //Counters of other parts of the server, e.g. connection pool statistics, are added to dumps
+    void addCounters(const std::string &name, std::function<Counters()> counters);
+    //JSON with counters and, for every database and its statements, count, mean, p50, p90, p99, p999 and max of phases
+    std::string dump();
+};
+
+#endif // METRICS_H
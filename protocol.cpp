@@ -0,0 +1,100 @@
+#include "protocol.h"
+
+const uint32_t Protocol::maxFrameLength;
+
+void Protocol::putUint16(std::string &out, uint16_t value)
+{
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+void Protocol::putUint32(std::string &out, uint32_t value)
+{
+    out += static_cast<char>(value >> 24);
+    out += static_cast<char>(value >> 16);
+    out += static_cast<char>(value >> 8);
+    out += static_cast<char>(value);
+}
+
+uint16_t Protocol::getUint16(const char *in)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(in);
+    return static_cast<uint16_t>(bytes[0] << 8 | bytes[1]);
+}
+
+uint32_t Protocol::getUint32(const char *in)
+{
+    const unsigned char *bytes = reinterpret_cast<const unsigned char *>(in);
+    return static_cast<uint32_t>(bytes[0]) << 24 | static_cast<uint32_t>(bytes[1]) << 16
+            | static_cast<uint32_t>(bytes[2]) << 8 | static_cast<uint32_t>(bytes[3]);
+}
+
+std::string Protocol::encodeRequest(const Request &request)
+{
+    std::string frame;
+    std::size_t length = requestHeaderSize + request.database.size() + request.query.size()
+            + (request.flags & Request::Timeout ? timeoutSize : 0) + (request.flags & Request::Compressed ? compressionSize : 0);
+    frame.reserve(lengthSize + length);
+    putUint32(frame, static_cast<uint32_t>(length));
+    putUint32(frame, request.id);
+    frame += static_cast<char>(request.type);
+    frame += static_cast<char>(request.flags);
+    putUint16(frame, static_cast<uint16_t>(request.database.size()));
+    frame += request.database;
+    if (request.flags & Request::Timeout)
+        putUint32(frame, request.timeout);
+    if (request.flags & Request::Compressed)
+    {
+        frame += static_cast<char>(request.compression);
+        frame += static_cast<char>(request.compressionLevel);
+    }
+    frame += request.query;
+    return frame;
+}
+
+bool Protocol::decodeRequest(const char *frame, std::size_t length, Request &request)
+{
+    if (length < requestHeaderSize)
+        return false;
+    request.id = getUint32(frame);
+    request.type = static_cast<uint8_t>(frame[4]);
+    request.flags = static_cast<uint8_t>(frame[5]);
+    std::size_t databaseLength = getUint16(frame + 6);
+    std::size_t compressionOffset = requestHeaderSize + databaseLength + (request.flags & Request::Timeout ? timeoutSize : 0);
+    std::size_t queryOffset = compressionOffset + (request.flags & Request::Compressed ? compressionSize : 0);
+    if (queryOffset > length)
+        return false;
+    request.database.assign(frame + requestHeaderSize, databaseLength);
+    request.timeout = request.flags & Request::Timeout ? getUint32(frame + requestHeaderSize + databaseLength) : 0;
+    request.compression = request.flags & Request::Compressed ? static_cast<uint8_t>(frame[compressionOffset]) : static_cast<uint8_t>(Request::NoCompression);
+    request.compressionLevel = request.flags & Request::Compressed ? static_cast<uint8_t>(frame[compressionOffset + 1]) : 0;
+    request.query.assign(frame + queryOffset, length - queryOffset);
+    return true;
+}
+
+const std::string &Response::body() const
+{
+    return shared ? *shared : payload;
+}
+
+std::string Protocol::encodeResponseHeader(const Response &response)
+{
+    std::string header;
+    header.reserve(lengthSize + responseHeaderSize);
+    putUint32(header, static_cast<uint32_t>(responseHeaderSize + response.body().size()));
+    putUint32(header, response.id);
+    header += static_cast<char>(response.status);
+    header += static_cast<char>(response.flags);
+    return header;
+}
+
+bool Protocol::decodeResponse(const char *frame, std::size_t length, Response &response)
+{
+    if (length < responseHeaderSize)
+        return false;
+    response.id = getUint32(frame);
+    response.status = static_cast<uint8_t>(frame[4]);
+    response.flags = static_cast<uint8_t>(frame[5]);
+    response.payload.assign(frame + responseHeaderSize, length - responseHeaderSize);
+    return true;
+}
@@ -0,0 +1,80 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+
+//Every frame starts with a 4 byte big-endian length of the rest of the frame.
+//Request:  length | id (4) | type (1) | flags (1) | database length (2) | database | [timeout (4)]
+//          | [compression (1) | level (1)] | query
+//Response: length | id (4) | status (1) | flags (1) | payload
+//Query is "<sql>[\x1E<param>\x1F<param>...]..." - see ConnectionHandler::takeParameters.
+//Responses carry the id of their request. Requests without the Unordered flag are run one after
+//another and answered in the order they were sent. Unordered requests may run concurrently with
+//any other request of the connection and their responses may overtake earlier ones.
+//A Streamed SELECT is answered with several frames in Result's streamed format, all but the last
+//one have the More flag. Rows are read from SQLite only as fast as the client takes them.
+//With the Binary flag a SELECT is answered in Result's binary format instead of the text one and the
+//response has the Binary flag too. Every frame of a Binary Streamed result is a complete binary Result.
+//Errors are always text.
+//A Metrics request is answered with the JSON of Metrics::dump(), its database and query are ignored.
+//With the Timeout flag the request carries its own time limit in milliseconds instead of the default of
+//the server, 0 means no limit. A query still running when the time is over is interrupted with an error.
+//A Cancel request interrupts the running request of the connection whose id is its query. Requests
+//still running when the client closes the connection, even if it only shuts down its sending side, or
+//when the connection fails are cancelled too. Responses of all requests are still written until the socket closes.
+//With the Compressed flag the client accepts responses compressed with the given compression, only
+//Zlib yet, at the given level, 1 to 9 or 0 for the default one. Successful responses longer than the
+//threshold of the server are then sent with the Compressed flag and their payload is the zlib stream of
+//the body. Every frame of a Streamed result is compressed on its own.
+//A Busy response means the request was rejected before it ran. If its queue was full the payload
+//ends with "retry after <n> ms", the time the queue is expected to need to make room.
+//A Trace request traces every n-th request from now on, n is its query. "0" stops tracing and
+//writes the trace file of the server, see Tracer.
+
+struct Request
+{
+    enum Type : uint8_t {Query = 0, Metrics = 1, Trace = 2, Cancel = 3};
+    enum Flags : uint8_t {Unordered = 0x01, Streamed = 0x02, Binary = 0x04, Timeout = 0x08, Compressed = 0x10};
+    enum Compression : uint8_t {NoCompression = 0, Zlib = 1};
+    uint32_t id = 0;
+    uint8_t type = Query;
+    uint8_t flags = 0;
+    std::string database;
+    uint32_t timeout = 0;//Milliseconds, sent with the Timeout flag only
+    uint8_t compression = NoCompression;//Sent with the Compressed flag only
+    uint8_t compressionLevel = 0;
+    std::string query;
+};
+
+struct Response
+{
+    enum Status : uint8_t {Ok = 0, Error = 1, Busy = 2};
+    enum Flags : uint8_t {More = 0x01, Binary = 0x02, Compressed = 0x04};
+    uint32_t id = 0;
+    uint8_t status = Ok;
+    uint8_t flags = 0;
+    std::string payload;
+    std::shared_ptr<const std::string> shared;//Sent instead of payload if set, e.g. one result answering several requests
+    const std::string &body() const;
+};
+
+class Protocol
+{
+public:
+    enum {lengthSize = 4, requestHeaderSize = 8, timeoutSize = 4, compressionSize = 2, responseHeaderSize = 6};
+    static const uint32_t maxFrameLength = 64 * 1024 * 1024;
+    static void putUint16(std::string &out, uint16_t value);
+    static void putUint32(std::string &out, uint32_t value);
+    static uint16_t getUint16(const char *in);
+    static uint32_t getUint32(const char *in);
+    static std::string encodeRequest(const Request &request);
+    //frame points past the length field. Returns false if the frame is malformed
+    static bool decodeRequest(const char *frame, std::size_t length, Request &request);
+    //Length, id, status and flags. Payload is sent right after it to avoid copying it
+    static std::string encodeResponseHeader(const Response &response);
+    static bool decodeResponse(const char *frame, std::size_t length, Response &response);
+};
+
+#endif // PROTOCOL_H
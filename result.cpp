@@ -1,4 +1,8 @@
 #include "result.h"
+#include <cstdio>
+#include <charconv>
+#include <cstring>
+#include <stdexcept>
 
 Result::Result()
 {
@@ -8,6 +12,68 @@ Result::Result()
 Result::Result(Result &other)
 {
     _result = std::move(other._result);
+    _arena = std::move(other._arena);
+}
+
+void Result::_setType(Column &column, Type type)
+{
+    if (column.type == type)
+        return;
+    if (column.type == Null)
+    {
+        //Earlier rows were all NULL and get placeholders in the storage of the new type
+        column.type = type;
+        if (type == Integer)
+            column.integers.assign(column.rows, 0);
+        else if (type == Float)
+            column.floats.assign(column.rows, 0);
+        else
+            column.cells.assign(column.rows, Arena::Span());
+        return;
+    }
+    if (column.type == Text || column.type == Blob)
+        column.type = Text;
+    else
+        _convertToText(column);
+}
+
+void Result::_convertToText(Column &column)
+{
+    column.cells.clear();
+    column.cells.reserve(column.rows);
+    for (std::size_t i = 0; i < column.rows; i++)
+    {
+        std::string text;
+        if (!(column.nulls[i / 64] >> (i % 64) & 1))
+            text = column.type == Integer ? std::to_string(column.integers[i]) : _floatToString(column.floats[i]);
+        column.cells.push_back(_arena.store(text.data(), text.size()));
+    }
+    std::vector<int64_t>().swap(column.integers);
+    std::vector<double>().swap(column.floats);
+    column.type = Text;
+}
+
+void Result::_appendNullFlag(Column &column, bool isNull)
+{
+    if (column.rows % 64 == 0)
+        column.nulls.push_back(0);
+    if (isNull)
+        column.nulls.back() |= uint64_t(1) << (column.rows % 64);
+    column.rows++;
+}
+
+std::string Result::_floatToString(double value)
+{
+    //Same text as SQLite gives for REAL values
+    char buffer[32];
+    int length = std::snprintf(buffer, sizeof(buffer), "%.15g", value);
+    std::string text(buffer, length);
+    if (text.find_first_of(".ni") == std::string::npos)
+    {
+        auto exponent = text.find('e');
+        text.insert(exponent == std::string::npos ? text.size() : exponent, ".0");
+    }
+    return text;
 }
 
 void Result::resize(const int numberOfColumns)
@@ -18,9 +84,10 @@ void Result::resize(const int numberOfColumns)
 void Result::resize(const int numberOfColumns, const int numberOfRows)
 {
     _result.resize(numberOfColumns);
-    for(auto &i : _result)
+    for (unsigned int i = 0; i < _result.size(); i++)
     {
-        i.values.resize(numberOfRows);
+        while (_result[i].rows < static_cast<std::size_t>(numberOfRows))
+            addNull(i);
     }
 }
 
@@ -45,23 +112,87 @@ int Result::getIndexOf(const std::string &columnName) const
 void Result::addColumn(const std::string &name, int index)
 {
     _result[index].name = name;
-    if (_result[index].values.capacity() < 50)
-        _result[index].values.reserve(50);
 }
 
 void Result::addValue(const std::string &value, int columnIndex)
 {
-    _result[columnIndex].values.push_back(value);
+    addText(value.data(), value.size(), columnIndex);
 }
 
 void Result::addValue(const std::string &value, const std::string &columnName)
 {
-    _result[getIndexOf(columnName)].values.push_back(value);
+    addText(value.data(), value.size(), getIndexOf(columnName));
+}
+
+void Result::addNull(int columnIndex)
+{
+    Column &column = _result[columnIndex];
+    switch (column.type)
+    {
+    case Integer:
+        column.integers.push_back(0);
+        break;
+    case Float:
+        column.floats.push_back(0);
+        break;
+    case Text:
+    case Blob:
+        column.cells.push_back(Arena::Span());
+        break;
+    case Null:
+        break;
+    }
+    _appendNullFlag(column, true);
+}
+
+void Result::addInteger(int64_t value, int columnIndex)
+{
+    Column &column = _result[columnIndex];
+    _setType(column, Integer);
+    if (column.type == Integer)
+        column.integers.push_back(value);
+    else
+    {
+        std::string text = std::to_string(value);
+        column.cells.push_back(_arena.store(text.data(), text.size()));
+    }
+    _appendNullFlag(column, false);
+}
+
+void Result::addFloat(double value, int columnIndex)
+{
+    Column &column = _result[columnIndex];
+    _setType(column, Float);
+    if (column.type == Float)
+        column.floats.push_back(value);
+    else
+    {
+        std::string text = _floatToString(value);
+        column.cells.push_back(_arena.store(text.data(), text.size()));
+    }
+    _appendNullFlag(column, false);
+}
+
+void Result::addText(const char *value, std::size_t length, int columnIndex)
+{
+    Column &column = _result[columnIndex];
+    _setType(column, Text);
+    column.cells.push_back(_arena.store(value, length));
+    _appendNullFlag(column, false);
+}
+
+void Result::addBlob(const void *value, std::size_t length, int columnIndex)
+{
+    Column &column = _result[columnIndex];
+    _setType(column, Blob);
+    column.cells.push_back(_arena.store(static_cast<const char *>(value), length));
+    _appendNullFlag(column, false);
 }
 
 void Result::clear()
 {
     _result.clear();
+    _arena.reset();
 }
 
 unsigned int Result::size() const
@@ -69,6 +200,11 @@ unsigned int Result::size() const
     return _result.size();
 }
 
+unsigned int Result::rows() const
+{
+    return _result.empty() ? 0 : _result[0].rows;
+}
+
 const std::vector<Result::Column> &Result::result() const
 {
     return _result;
@@ -86,68 +222,449 @@ std::string Result::columns(const std::string delimiter)
     return _columns;
 }
 
-const std::vector<std::string> &Result::rowsAt(const std::string &columnName) const
+const std::string &Result::columnName(int column) const
+{
+    return _result[column].name;
+}
+
+Result::Type Result::columnType(int column) const
 {
-    return _result[getIndexOf(columnName)].values;
+    return _result[column].type;
+}
+
+std::vector<std::string> Result::rowsAt(const std::string &columnName) const
+{
+    int column = getIndexOf(columnName);
+    std::vector<std::string> values;
+    values.reserve(_result[column].rows);
+    for (std::size_t i = 0; i < _result[column].rows; i++)
+        values.push_back(valueAt(column, i));
+    return values;
 }
 
 std::string Result::valueAt(const std::string columnName, int row) const
 {
-    return _result[getIndexOf(columnName)].values[row];
+    return valueAt(getIndexOf(columnName), row);
 }
 
 std::string Result::valueAt(int column, int row) const
 {
-    return _result[column].values[row];
+    const Column &_column = _result[column];
+    if (isNull(column, row))
+        return std::string();
+    switch (_column.type)
+    {
+    case Integer:
+        return std::to_string(_column.integers[row]);
+    case Float:
+        return _floatToString(_column.floats[row]);
+    default:
+        return std::string(bytesAt(column, row));
+    }
+}
+
+Result::Type Result::typeAt(int column, int row) const
+{
+    return isNull(column, row) ? Null : _result[column].type;
+}
+
+bool Result::isNull(int column, int row) const
+{
+    return _result[column].nulls[row / 64] >> (row % 64) & 1;
+}
+
+int64_t Result::integerAt(int column, int row) const
+{
+    const Column &_column = _result[column];
+    if (_column.type == Integer)
+        return _column.integers[row];
+    if (_column.type == Float)
+        return static_cast<int64_t>(_column.floats[row]);
+    throw std::logic_error("Column " + _column.name + " doesn't hold numbers");
+}
+
+double Result::floatAt(int column, int row) const
+{
+    const Column &_column = _result[column];
+    if (_column.type == Float)
+        return _column.floats[row];
+    if (_column.type == Integer)
+        return static_cast<double>(_column.integers[row]);
+    throw std::logic_error("Column " + _column.name + " doesn't hold numbers");
+}
+
+std::string_view Result::bytesAt(int column, int row) const
+{
+    const Column &_column = _result[column];
+    if (_column.type != Text && _column.type != Blob)
+        throw std::logic_error("Column " + _column.name + " doesn't hold text");
+    return _arena.view(_column.cells[row]);
 }
 
 std::string Result::resultToString() const
 {
     std::string _resultToString;
     unsigned int numberOfColumns = _result.size();
-    unsigned int numberOfRows = _result[0].values.size();
+    unsigned int numberOfRows = rows();
     _resultToString += "Columns:" + std::to_string(numberOfColumns) + '\n';
     _resultToString += "Rows:" + std::to_string(numberOfRows) + '\n';
     for (unsigned int i = 0; i < numberOfColumns; i++)
     {
-        _resultToString += "Column:" + _result[i].name + '\n';
+        _resultToString += "Column:" + _result[i].name;
         for (unsigned int j = 0; j < numberOfRows; j++)
         {
-            _resultToString += _result[i].values[j];
-            if (j < numberOfRows - 1)
-                _resultToString += '\n';
+            _resultToString += '\n';
+            if (isNull(i, j))
+                continue;
+            switch (_result[i].type)
+            {
+            case Integer:
+                _resultToString += std::to_string(_result[i].integers[j]);
+                break;
+            case Float:
+                _resultToString += _floatToString(_result[i].floats[j]);
+                break;
+            default:
+                _resultToString += _arena.view(_result[i].cells[j]);
+            }
         }
         if (i < numberOfColumns - 1)
             _resultToString += '\n';
-        else
-            _resultToString += EOF;
     }
+    _resultToString += EOF;
     return _resultToString;
 }
 
 void Result::resultFromString(const std::string &result)
 {
-    auto start = result.find("Columns:") + 8;
-    auto end = result.find_first_of('\n');
-    unsigned int numberOfColumns = std::atoi(result.substr(start, end - start).c_str());
-    start = result.find("Rows:", end) + 5;
-    end = result.find_first_of('\n', start);
-    unsigned int numberOfRows = std::atoi(result.substr(start, end - start).c_str());
-    resize(numberOfColumns, numberOfRows);
-    for (unsigned int i = 0; i < numberOfColumns; i++)
+    clear();
+    _parseString(_arena.store(result.data(), result.size()));
+}
+
+void Result::resultFromString(std::string &&result)
+{
+    clear();
+    _parseString(_arena.adopt(std::move(result)));
+}
+
+bool Result::_readLine(const char *&position, const char *end, char delimiter, std::string_view &line)
+{
+    //memchr is vectorized by the C library, so the scan goes many bytes at a time
+    if (position > end)
+        return false;
+    const char *found = position < end ? static_cast<const char *>(std::memchr(position, delimiter, end - position)) : nullptr;
+    if (found == nullptr)
+        found = end;
+    line = std::string_view(position, found - position);
+    position = found + 1;
+    return true;
+}
+
+bool Result::_readCount(std::string_view line, std::string_view prefix, std::size_t &count)
+{
+    if (line.substr(0, prefix.size()) != prefix)
+        return false;
+    const char *first = line.data() + prefix.size(), *last = line.data() + line.size();
+    auto parsed = std::from_chars(first, last, count);
+    return parsed.ec == std::errc() && parsed.ptr == last;
+}
+
+Arena::Span Result::_spanOf(const Arena::Span &buffer, const char *begin, std::string_view value) const
+{
+    Arena::Span span;
+    if (value.empty())
+        return span;
+    span.chunk = buffer.chunk;
+    span.offset = buffer.offset + static_cast<uint32_t>(value.data() - begin);
+    span.length = static_cast<uint32_t>(value.size());
+    return span;
+}
+
+void Result::_parseString(const Arena::Span &buffer)
+{
+    std::string_view text = _arena.view(buffer);
+    const char *begin = text.data(), *position = begin, *end = begin + text.size();
+    if (position != end && end[-1] == static_cast<char>(EOF))
+        end--;
+    std::string_view line;
+    std::size_t numberOfColumns, numberOfRows;
+    if (!_readLine(position, end, '\n', line) || !_readCount(line, "Columns:", numberOfColumns)
+            || !_readLine(position, end, '\n', line) || !_readCount(line, "Rows:", numberOfRows))
+        throw std::invalid_argument("Malformed result header");
+    //Every column takes "Column:" and every value at least its \n, so counts are checked before memory is reserved for them
+    std::size_t left = position < end ? end - position : 0;
+    if (numberOfColumns > left / 7 || (numberOfColumns != 0 && numberOfRows > left))
+        throw std::invalid_argument("Malformed result header: counts exceed the input");
+    resize(numberOfColumns);
+    for (std::size_t i = 0; i < numberOfColumns; i++)
     {
-        start = result.find_first_of("Column:", end) + 7;
-        end = result.find_first_of('\n', start);
-        _result[i].name = result.substr(start, end - start);
-        for (unsigned int j = 0; j < numberOfRows; j++)
+        if (!_readLine(position, end, '\n', line) || line.substr(0, 7) != "Column:")
+            throw std::invalid_argument("Malformed result: column " + std::to_string(i) + " is missing");
+        Column &column = _result[i];
+        column.name.assign(line.data() + 7, line.size() - 7);
+        column.type = Text;
+        column.rows = numberOfRows;
+        column.nulls.assign((numberOfRows + 63) / 64, 0);
+        column.cells.reserve(numberOfRows);
+        for (std::size_t j = 0; j < numberOfRows; j++)
         {
-            start = end + 1;
-            if (j == numberOfRows - 1 && i == numberOfColumns - 1)
-                end = result.find_last_of(EOF);
-            else
-                end = result.find_first_of('\n', start);
-            _result[i].values[j] = result.substr(start, end - start);
+            if (!_readLine(position, end, '\n', line))
+                throw std::invalid_argument("Malformed result: column " + column.name + " has less rows than expected");
+            column.cells.push_back(_spanOf(buffer, begin, line));
+        }
+    }
+}
+
+void Result::streamHeaderToString(std::string &stream, const std::vector<std::string> &columns)
+{
+    stream += "Columns:" + std::to_string(columns.size()) + '\n';
+    for (auto &i : columns)
+        stream += "Column:" + i + '\n';
+}
+
+void Result::streamRowToString(std::string &stream, int argc, char **argv)
+{
+    for (int i = 0; i < argc; i++)
+    {
+        if (argv[i])
+            stream += argv[i];
+        if (i < argc - 1)
+            stream += '\x1F';
+    }
+    stream += '\x1E';
+}
+
+void Result::resultFromStream(const std::string &stream)
+{
+    clear();
+    _parseStream(_arena.store(stream.data(), stream.size()));
+}
+
+void Result::resultFromStream(std::string &&stream)
+{
+    clear();
+    _parseStream(_arena.adopt(std::move(stream)));
+}
+
+void Result::_parseStream(const Arena::Span &buffer)
+{
+    std::string_view text = _arena.view(buffer);
+    const char *begin = text.data(), *position = begin, *end = begin + text.size();
+    std::string_view line;
+    std::size_t numberOfColumns;
+    if (!_readLine(position, end, '\n', line) || !_readCount(line, "Columns:", numberOfColumns))
+        throw std::invalid_argument("Malformed result stream header");
+    resize(numberOfColumns);
+    for (std::size_t i = 0; i < numberOfColumns; i++)
+    {
+        if (!_readLine(position, end, '\n', line) || line.substr(0, 7) != "Column:")
+            throw std::invalid_argument("Malformed result stream: column " + std::to_string(i) + " is missing");
+        _result[i].name.assign(line.data() + 7, line.size() - 7);
+        _result[i].type = Text;
+    }
+    while (numberOfColumns != 0 && position < end)
+    {
+        //Values of a row are divided by \x1F, the last one ends with \x1E
+        for (std::size_t i = 0; i < numberOfColumns; i++)
+        {
+            if (!_readLine(position, end, i < numberOfColumns - 1 ? '\x1F' : '\x1E', line))
+                throw std::invalid_argument("Malformed result stream: row is truncated");
+            Column &column = _result[i];
+            column.cells.push_back(_spanOf(buffer, begin, line));
+            _appendNullFlag(column, false);
+        }
+    }
+}
+
+void Result::_putVarint(std::string &out, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        out += static_cast<char>(value | 0x80);
+        value >>= 7;
+    }
+    out += static_cast<char>(value);
+}
+
+bool Result::_getVarint(const char *&position, const char *end, uint64_t &value)
+{
+    value = 0;
+    for (unsigned int shift = 0; position < end && shift < 64; shift += 7)
+    {
+        uint8_t byte = static_cast<uint8_t>(*position++);
+        value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+void Result::_putNumbers(std::string &out, const void *values, std::size_t count)
+{
+    //int64_t and double arrays are written as they are in memory on little-endian hosts
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    const uint64_t *words = static_cast<const uint64_t *>(values);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        uint64_t word;
+        std::memcpy(&word, words + i, 8);
+        for (int j = 0; j < 8; j++)
+            out += static_cast<char>(word >> (8 * j));
+    }
+#else
+    out.append(static_cast<const char *>(values), count * 8);
+#endif
+}
+
+void Result::_getNumbers(const char *in, void *values, std::size_t count)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    uint64_t *words = static_cast<uint64_t *>(values);
+    for (std::size_t i = 0; i < count; i++)
+    {
+        uint64_t word = 0;
+        for (int j = 0; j < 8; j++)
+            word |= static_cast<uint64_t>(static_cast<uint8_t>(in[i * 8 + j])) << (8 * j);
+        std::memcpy(words + i, &word, 8);
+    }
+#else
+    std::memcpy(values, in, count * 8);
+#endif
+}
+
+std::string Result::resultToBinary() const
+{
+    std::string binary;
+    std::size_t numberOfRows = rows();
+    std::size_t estimate = 16;
+    for (auto &i : _result)
+        estimate += i.name.size() + 12 + numberOfRows * 9 + (numberOfRows + 7) / 8;
+    binary.reserve(estimate);
+    _putVarint(binary, _result.size());
+    for (auto &i : _result)
+    {
+        _putVarint(binary, i.name.size());
+        binary += i.name;
+        binary += static_cast<char>(i.type);
+    }
+    _putVarint(binary, numberOfRows);
+    for (auto &i : _result)
+    {
+        bool hasNulls = false;
+        for (auto word : i.nulls)
+            hasNulls = hasNulls || word != 0;
+        binary += static_cast<char>(hasNulls);
+        if (hasNulls)
+        {
+            for (std::size_t j = 0, n = (numberOfRows + 7) / 8; j < n; j++)
+                binary += static_cast<char>(i.nulls[j / 8] >> (8 * (j % 8)));
+        }
+        switch (i.type)
+        {
+        case Integer:
+            _putNumbers(binary, i.integers.data(), numberOfRows);
+            break;
+        case Float:
+            _putNumbers(binary, i.floats.data(), numberOfRows);
+            break;
+        case Text:
+        case Blob:
+            for (auto &cell : i.cells)
+            {
+                _putVarint(binary, cell.length);
+                binary += _arena.view(cell);
+            }
+            break;
+        case Null:
+            break;
         }
     }
+    return binary;
+}
+
+void Result::resultFromBinary(const std::string &binary)
+{
+    clear();
+    _parseBinary(_arena.store(binary.data(), binary.size()));
+}
+
+void Result::resultFromBinary(std::string &&binary)
+{
+    clear();
+    _parseBinary(_arena.adopt(std::move(binary)));
+}
 
+void Result::_parseBinary(const Arena::Span &buffer)
+{
+    std::string_view binary = _arena.view(buffer);
+    const char *begin = binary.data(), *position = begin, *end = begin + binary.size();
+    uint64_t numberOfColumns, numberOfRows, length;
+    if (!_getVarint(position, end, numberOfColumns) || numberOfColumns > static_cast<uint64_t>(end - position))
+        throw std::invalid_argument("Malformed binary result header");
+    resize(numberOfColumns);
+    for (auto &i : _result)
+    {
+        if (!_getVarint(position, end, length) || length + 1 > static_cast<uint64_t>(end - position))
+            throw std::invalid_argument("Malformed binary result: column is truncated");
+        i.name.assign(position, length);
+        position += length;
+        i.type = static_cast<Type>(*position++);
+        if (i.type > Blob)
+            throw std::invalid_argument("Malformed binary result: unknown type of column " + i.name);
+    }
+    //Rows of every column take at least a bit of the NULL bitmap or a byte of values
+    if (!_getVarint(position, end, numberOfRows)
+            || (numberOfColumns != 0 && numberOfRows / 8 > static_cast<uint64_t>(end - position)))
+        throw std::invalid_argument("Malformed binary result header");
+    for (auto &i : _result)
+    {
+        if (position >= end)
+            throw std::invalid_argument("Malformed binary result: column " + i.name + " is truncated");
+        bool hasNulls = *position++ != 0;
+        std::size_t bitmapLength = (numberOfRows + 7) / 8;
+        i.rows = numberOfRows;
+        i.nulls.assign((numberOfRows + 63) / 64, 0);
+        if (hasNulls)
+        {
+            if (bitmapLength > static_cast<std::size_t>(end - position))
+                throw std::invalid_argument("Malformed binary result: column " + i.name + " is truncated");
+            for (std::size_t j = 0; j < bitmapLength; j++)
+                i.nulls[j / 8] |= static_cast<uint64_t>(static_cast<uint8_t>(position[j])) << (8 * (j % 8));
+            position += bitmapLength;
+        }
+        switch (i.type)
+        {
+        case Integer:
+        case Float:
+            if (numberOfRows > static_cast<uint64_t>(end - position) / 8)
+                throw std::invalid_argument("Malformed binary result: column " + i.name + " is truncated");
+            if (i.type == Integer)
+            {
+                i.integers.resize(numberOfRows);
+                _getNumbers(position, i.integers.data(), numberOfRows);
+            }
+            else
+            {
+                i.floats.resize(numberOfRows);
+                _getNumbers(position, i.floats.data(), numberOfRows);
+            }
+            position += numberOfRows * 8;
+            break;
+        case Text:
+        case Blob:
+            if (numberOfRows > static_cast<uint64_t>(end - position))
+                throw std::invalid_argument("Malformed binary result: column " + i.name + " is truncated");
+            i.cells.reserve(numberOfRows);
+            for (uint64_t j = 0; j < numberOfRows; j++)
+            {
+                if (!_getVarint(position, end, length) || length > static_cast<uint64_t>(end - position))
+                    throw std::invalid_argument("Malformed binary result: column " + i.name + " is truncated");
+                i.cells.push_back(_spanOf(buffer, begin, std::string_view(position, length)));
+                position += length;
+            }
+            break;
+        case Null:
+            break;
+        }
+    }
 }
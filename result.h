@@ -1,17 +1,47 @@
 ﻿#ifndef RESULT_H
 #define RESULT_H
+#include <cstddef>
+#include <cstdint>
 #include <string>
+#include <string_view>
 #include <vector>
+#include "arena.h"
 
 class Result
 {
+public:
+    enum Type : uint8_t {Null = 0, Integer = 1, Float = 2, Text = 3, Blob = 4};
 private:
+    //Values of a column are kept in the storage of its type: integers and floats in contiguous arrays,
+    //text and blobs in the arena of the Result, addressed by cells. NULL cells are marked in a bitmap and keep
+    //a zero/empty placeholder so that row n is always at index n. A column which gets values of
+    //different types, integers and floats too, is converted to Text holding the text SQLite gives for each value.
     struct Column
     {
         std::string name;
-        std::vector<std::string> values;
+        Type type = Null;//Null while all values are NULL
+        std::size_t rows = 0;
+        std::vector<uint64_t> nulls;
+        std::vector<int64_t> integers;
+        std::vector<double> floats;
+        std::vector<Arena::Span> cells;
     };
     std::vector<Column> _result;
+    Arena _arena;
+    void _setType(Column &column, Type type);
+    void _convertToText(Column &column);
+    static void _appendNullFlag(Column &column, bool isNull);
+    static std::string _floatToString(double value);
+    static bool _readLine(const char *&position, const char *end, char delimiter, std::string_view &line);
+    static bool _readCount(std::string_view line, std::string_view prefix, std::size_t &count);
+    Arena::Span _spanOf(const Arena::Span &buffer, const char *begin, std::string_view value) const;
+    void _parseString(const Arena::Span &buffer);
+    void _parseStream(const Arena::Span &buffer);
+    void _parseBinary(const Arena::Span &buffer);
+    static void _putVarint(std::string &out, uint64_t value);
+    static bool _getVarint(const char *&position, const char *end, uint64_t &value);
+    static void _putNumbers(std::string &out, const void *values, std::size_t count);
+    static void _getNumbers(const char *in, void *values, std::size_t count);
 public:
     Result();
     Result(Result &other);
@@ -20,20 +50,54 @@ public:
     Result &operator = (const Result &other) = delete;
     Result &operator = (Result &&other) = default;
     void resize (const int numberOfColumns);
-    void resize (const int numberOfColumns, const int numberOfRows);
+    void resize (const int numberOfColumns, const int numberOfRows);//New rows are NULL
     int getIndexOf(const std::string &columnName) const;
     void addColumn(const std::string &name, int index);
     void addValue(const std::string &value, int columnIndex);
     void addValue(const std::string &value, const std::string &columnName);
+    void addNull(int columnIndex);
+    void addInteger(int64_t value, int columnIndex);
+    void addFloat(double value, int columnIndex);
+    void addText(const char *value, std::size_t length, int columnIndex);
+    void addBlob(const void *value, std::size_t length, int columnIndex);
     const std::vector<Column> &result() const;
     std::string columns(const std::string delimiter);
-    const std::vector<std::string> &rowsAt(const std::string &columnName) const;
+    const std::string &columnName(int column) const;
+    Type columnType(int column) const;
+    std::vector<std::string> rowsAt(const std::string &columnName) const;
+    //Values are converted to text the way SQLite does it, NULL is an empty string
     std::string valueAt(const std::string columnName, int row) const;
     std::string valueAt(int column, int row) const;
+    Type typeAt(int column, int row) const;
+    bool isNull(int column, int row) const;
+    int64_t integerAt(int column, int row) const;//Integer and Float columns
+    double floatAt(int column, int row) const;//Integer and Float columns
+    std::string_view bytesAt(int column, int row) const;//Text and Blob columns. Valid until clear()
+    //Frees all values at once, memory of the arena is kept for the next result
     void clear();
     unsigned int size() const;
+    unsigned int rows() const;
     virtual std::string resultToString() const;
+    //Parsers throw std::invalid_argument on malformed input. Values stay in one copy of the input
+    //held by the arena, the rvalue overloads take over the string itself instead of copying it
     virtual void resultFromString(const std::string &result);
+    void resultFromString(std::string &&result);
+    //Streamed format is row by row so it can be sent before the last row is read:
+    //"Columns:N\n" and "Column:<name>\n" for every column, then rows. Values of a row are divided by \x1F,
+    //every row ends with \x1E.
+    static void streamHeaderToString(std::string &stream, const std::vector<std::string> &columns);
+    static void streamRowToString(std::string &stream, int argc, char **argv);
+    void resultFromStream(const std::string &stream);
+    void resultFromStream(std::string &&stream);
+    //Binary format keeps types and is written column by column:
+    //varint columns, for every column varint name length, name and type byte, varint rows,
+    //then for every column a byte telling if it has NULLs, a NULL bitmap of (rows + 7) / 8 bytes
+    //if it does (bit n of the bitmap is row n, least significant bit first) and the values:
+    //Integer - 8 byte little-endian, Float - 8 byte little-endian IEEE 754,
+    //Text and Blob - varint length and bytes. NULL cells are 0 or empty, Null columns have no values.
+    std::string resultToBinary() const;
+    void resultFromBinary(const std::string &binary);
+    void resultFromBinary(std::string &&binary);
 
     virtual ~Result() = default;
 };
@@ -0,0 +1,133 @@
+#include "resultcache.h"
+#include "connectionpool.h"
+
+ResultCache::ResultCache(std::size_t budget)
+{
+    _statistics.budget = budget;
+}
+
+std::string ResultCache::key(const std::string &database, const std::string &query,
+                             const std::vector<std::vector<std::string>> &parameters, uint8_t format)
+{
+    std::string key = ConnectionPool::normalizedName(database);
+    key += '\0';
+    key += static_cast<char>(format);
+    key += StatementCache::normalize(query);
+    for (auto &row : parameters)
+    {
+        key += '\x1E';
+        for (std::size_t i = 0; i < row.size(); i++)
+        {
+            if (i != 0)
+                key += '\x1F';
+            key += row[i];
+        }
+    }
+    return key;
+}
+
+ResultCache::Payload ResultCache::get(const std::string &key)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    auto found = _index.find(key);
+    if (found == _index.end())
+        return nullptr;
+    _statistics.hits++;
+    _entries.splice(_entries.begin(), _entries, found->second);
+    return found->second->payload;
+}
+
+unsigned long long ResultCache::missed(const std::string &database)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    _statistics.misses++;
+    return _databases[ConnectionPool::normalizedName(database)].version;
+}
+
+void ResultCache::put(const std::string &database, const std::string &key, const Payload &payload,
+                      const std::set<std::string> &tables, unsigned long long version)
+{
+    std::string name = ConnectionPool::normalizedName(database);
+    //Keys, names of tables and list and index nodes are counted too
+    std::size_t bytes = key.size() * 2 + payload->size() + 128;
+    for (auto &i : tables)
+        bytes += i.size() + 64;
+    std::lock_guard<std::mutex> guard(_lock);
+    Database &_database = _databases[name];
+    if (bytes > _statistics.budget || _database.version != version || _index.count(key) != 0)
+        return;
+    while (_statistics.bytes + bytes > _statistics.budget)
+    {
+        _erase(std::prev(_entries.end()));
+        _statistics.evictions++;
+    }
+    _entries.push_front({key, name, payload, std::vector<std::string>(tables.begin(), tables.end()), bytes});
+    _index[key] = _entries.begin();
+    for (auto &i : tables)
+        _database.readers[i].insert(key);
+    _statistics.bytes += bytes;
+    _statistics.insertions++;
+}
+
+void ResultCache::_erase(std::list<Entry>::iterator entry)
+{
+    Database &database = _databases[entry->database];
+    for (auto &i : entry->tables)
+    {
+        auto readers = database.readers.find(i);
+        readers->second.erase(entry->key);
+        if (readers->second.empty())
+            database.readers.erase(readers);
+    }
+    _statistics.bytes -= entry->bytes;
+    _index.erase(entry->key);
+    _entries.erase(entry);
+}
+
+void ResultCache::invalidate(const std::string &database, const std::set<std::string> &tables)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    Database &_database = _databases[ConnectionPool::normalizedName(database)];
+    _database.version++;
+    for (auto &i : tables)
+    {
+        auto readers = _database.readers.find(i);
+        if (readers == _database.readers.end())
+            continue;
+        //Erasing entries changes the set, so keys are copied first
+        std::vector<std::string> keys(readers->second.begin(), readers->second.end());
+        for (auto &key : keys)
+        {
+            auto found = _index.find(key);
+            if (found == _index.end())
+                continue;
+            _erase(found->second);
+            _statistics.invalidations++;
+        }
+    }
+}
+
+void ResultCache::invalidate(const std::string &database)
+{
+    std::string name = ConnectionPool::normalizedName(database);
+    std::lock_guard<std::mutex> guard(_lock);
+    _databases[name].version++;
+    for (auto i = _entries.begin(); i != _entries.end();)
+    {
+        auto next = std::next(i);
+        if (i->database == name)
+        {
+            _erase(i);
+            _statistics.invalidations++;
+        }
+        i = next;
+    }
+}
+
+ResultCache::Statistics ResultCache::statistics()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    Statistics statistics = _statistics;
+    statistics.entries = _entries.size();
+    return statistics;
+}
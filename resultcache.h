@@ -0,0 +1,72 @@
+#ifndef RESULTCACHE_H
+#define RESULTCACHE_H
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+//Encoded results of read queries kept in memory up to a byte budget and evicted least recently used first.
+//Entries remember the tables their query read and are dropped as soon as one of them is changed
+//through WriteQueue. Changes made to database files by other processes are not noticed.
+class ResultCache
+{
+public:
+    using Payload = std::shared_ptr<const std::string>;
+    struct Statistics
+    {
+        unsigned long long hits = 0;
+        unsigned long long misses = 0;
+        unsigned long long insertions = 0;
+        unsigned long long evictions = 0;
+        unsigned long long invalidations = 0;//Entries dropped because their tables were changed
+        std::size_t entries = 0;
+        std::size_t bytes = 0;
+        std::size_t budget = 0;
+    };
+private:
+    struct Entry
+    {
+        std::string key;
+        std::string database;
+        Payload payload;
+        std::vector<std::string> tables;
+        std::size_t bytes;
+    };
+    struct Database
+    {
+        unsigned long long version = 0;//Incremented on every invalidation
+        std::unordered_map<std::string, std::unordered_set<std::string>> readers;//Table -> keys of entries which read it
+    };
+    std::list<Entry> _entries;//Most recently used entry is at the front
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+    std::map<std::string, Database> _databases;
+    Statistics _statistics;
+    std::mutex _lock;
+    void _erase(std::list<Entry>::iterator entry);
+public:
+    explicit ResultCache(std::size_t budget);
+    ResultCache(const ResultCache &other) = delete;
+    ResultCache &operator = (const ResultCache &other) = delete;
+    //Same query with the same parameters and result format gives the same key
+    static std::string key(const std::string &database, const std::string &query,
+                           const std::vector<std::vector<std::string>> &parameters, uint8_t format);
+    //Payload is shared with the entry, not copied. Returns nullptr if there is no entry
+    Payload get(const std::string &key);
+    //Counts a miss of a read query. Returned version has to be taken before the query is run
+    //and passed to put, which doesn't store the result if its database changed in between
+    unsigned long long missed(const std::string &database);
+    void put(const std::string &database, const std::string &key, const Payload &payload,
+             const std::set<std::string> &tables, unsigned long long version);
+    void invalidate(const std::string &database, const std::set<std::string> &tables);
+    void invalidate(const std::string &database);//Every entry of the database, e.g. after its schema changed
+    Statistics statistics();
+};
+
+#endif // RESULTCACHE_H
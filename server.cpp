@@ -1,6 +1,263 @@
 #include "server.h"
+#include "logger.h"
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
 
-Server::Server()
+Server::Server() : Server(Settings())
 {
 
 }
+
+Server::Server(const Settings &settings) :
+    _settings(_resolved(settings)),
+    _signals(_service, SIGINT, SIGTERM),
+    _pool(_settings.pool),
+    _executor(_settings.databaseThreads, _settings.databaseQueueSize),
+    _cache(_settings.resultCacheSize != 0 ? new ResultCache(_settings.resultCacheSize) : nullptr),
+    _writes(_pool, _executor, _settings.writes, _cache.get()),
+    _compressor(_settings.compressionThreshold),
+    _services{_pool, _executor, _writes, _flights, _metrics, _cache.get(), _tracer, _settings.traceFile, _settings.queryTimeout,
+              _settings.queueByClient, _compressor},
+    _metricsTimer(_service)
+{
+    _metrics.addCounters("pool", [this] {
+        ConnectionPool::Statistics pool = _pool.statistics();
+        return Metrics::Counters{{"opened", pool.opened}, {"closed", pool.closed}, {"reused", pool.reused},
+                                 {"waited", pool.waited}, {"failed_health_checks", pool.failedHealthChecks}};
+    });
+    _executor.setDefaultLimits(_settings.queueLimits);
+    for (auto &i : _settings.queues)
+        _executor.setLimits(_settings.queueByClient ? i.first : ConnectionPool::normalizedName(i.first), i.second);
+    _metrics.addCounters("executor", [this] {
+        return Metrics::Counters{{"threads", _executor.threads()}, {"queued", _executor.queued()}};
+    });
+    _metrics.addCounters("admission", [this] {
+        Metrics::Counters counters;
+        for (auto &i : _executor.queueStatistics())
+        {
+            counters.emplace_back(i.first + ".queued", i.second.queued);
+            counters.emplace_back(i.first + ".running", i.second.running);
+            counters.emplace_back(i.first + ".admitted", i.second.admitted);
+            counters.emplace_back(i.first + ".rejected", i.second.rejected);
+        }
+        return counters;
+    });
+    _metrics.addCounters("writes", [this] {
+        WriteQueue::Statistics writes = _writes.statistics();
+        Metrics::Counters counters{{"writes", writes.writes}, {"failed_writes", writes.failedWrites}, {"commits", writes.commits},
+                                   {"failed_commits", writes.failedCommits}, {"largest_batch", writes.largestBatch}};
+        for (unsigned int i = 0; i < WriteQueue::batchSizeBuckets; i++)
+            counters.emplace_back("batches_from_" + std::to_string(1u << i), writes.batchSizes[i]);
+        return counters;
+    });
+    _metrics.addCounters("compression", [this] {
+        Compressor::Statistics compression = _compressor.statistics();
+        return Metrics::Counters{{"compressed", compression.compressed}, {"incompressible", compression.incompressible},
+                                 {"uncompressed_bytes", compression.uncompressedBytes}, {"compressed_bytes", compression.compressedBytes}};
+    });
+    _metrics.addCounters("single_flight", [this] {
+        SingleFlight::Statistics flights = _flights.statistics();
+        return Metrics::Counters{{"leaders", flights.leaders}, {"followers", flights.followers},
+                                 {"abandoned", flights.abandoned}};
+    });
+    if (_cache)
+    {
+        _metrics.addCounters("result_cache", [this] {
+            ResultCache::Statistics cache = _cache->statistics();
+            return Metrics::Counters{{"hits", cache.hits}, {"misses", cache.misses}, {"insertions", cache.insertions},
+                                     {"evictions", cache.evictions}, {"invalidations", cache.invalidations},
+                                     {"entries", cache.entries}, {"bytes", cache.bytes}, {"budget", cache.budget}};
+        });
+    }
+    _tracer.setSampling(_settings.traceSampling);
+    boost::asio::ip::tcp::endpoint endpoint(boost::asio::ip::address::from_string(_settings.address), _settings.port);
+    unsigned int shards = _settings.threadPerCore ? _settings.networkThreads : 1;
+    for (unsigned int i = 0; i < shards; i++)
+    {
+        _shards.emplace_back(new Shard());
+        boost::asio::ip::tcp::acceptor &acceptor = _shards.back()->acceptor;
+        acceptor.open(endpoint.protocol());
+        acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+        //Kernel spreads incoming connections over the acceptors bound to the same port
+        if (shards > 1)
+            acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+        acceptor.bind(endpoint);
+        acceptor.listen();
+        //Others bind to the port which the system chose for the first one
+        endpoint.port(acceptor.local_endpoint().port());
+    }
+}
+
+Server::Settings Server::_resolved(Settings settings)
+{
+    unsigned int hardwareThreads = std::thread::hardware_concurrency();
+    if (hardwareThreads == 0)
+        hardwareThreads = 1;
+    if (settings.networkThreads == 0)
+        settings.networkThreads = hardwareThreads;
+    if (settings.databaseThreads == 0)
+        settings.databaseThreads = hardwareThreads;
+    if (settings.metricsInterval.count() <= 0)
+        settings.metricsInterval = std::chrono::seconds(1);
+    //Database threads would otherwise wait for each other's connections
+    if (settings.pool.maxSize < settings.databaseThreads)
+        settings.pool.maxSize = settings.databaseThreads;
+    return settings;
+}
+
+void Server::_pinToCore(unsigned int index)
+{
+#ifdef __linux__
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0 || CPU_COUNT(&allowed) == 0)
+        return;
+    int wanted = index % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    {
+        if (CPU_ISSET(cpu, &allowed) && wanted-- == 0)
+        {
+            cpu_set_t core;
+            CPU_ZERO(&core);
+            CPU_SET(cpu, &core);
+            pthread_setaffinity_np(pthread_self(), sizeof(core), &core);
+            return;
+        }
+    }
+#else
+    (void)index;
+#endif
+}
+
+void Server::startAccept(Shard &shard)
+{
+    //Connection lives on the io_service of the shard which accepted it
+    ConnectionHandler::pointer connection = ConnectionHandler::create(shard.service, _services);
+    shard.acceptor.async_accept(connection->socket(),
+                                boost::bind(&Server::handleAccept, this, boost::ref(shard), connection, boost::asio::placeholders::error));
+}
+
+void Server::handleAccept(Shard &shard, ConnectionHandler::pointer connection, const boost::system::error_code &err)
+{
+    if (!shard.acceptor.is_open())
+        return;
+    if (!err)
+        connection->start();
+    else
+        Logger::error("server", "Accept error: " + err.message());
+    startAccept(shard);
+}
+
+void Server::scheduleMetricsDump()
+{
+    _metricsTimer.expires_after(_settings.metricsInterval);
+    _metricsTimer.async_wait(boost::bind(&Server::dumpMetrics, this, boost::asio::placeholders::error));
+}
+
+void Server::dumpMetrics(const boost::system::error_code &err)
+{
+    if (err == boost::asio::error::operation_aborted)
+        return;
+    //Readers of the file never see it half written
+    std::string temporary = _settings.metricsFile + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << _metrics.dump() << '\n';
+    }
+    if (std::rename(temporary.c_str(), _settings.metricsFile.c_str()) != 0)
+        Logger::error("server", "Metrics couldn't be written to " + _settings.metricsFile);
+    if (!err)
+        scheduleMetricsDump();
+}
+
+void Server::run()
+{
+    for (auto &i : _shards)
+        startAccept(*i);
+    if (!_settings.metricsFile.empty())
+        scheduleMetricsDump();
+    _signals.async_wait(boost::bind(&Server::stop, this));
+    Logger::info("server", "Listening on " + _settings.address + ':' + std::to_string(_settings.port)
+                 + " with " + std::to_string(_settings.networkThreads) + " network and "
+                 + std::to_string(_settings.databaseThreads) + " database threads"
+                 + (_settings.threadPerCore ? ", a core and an acceptor per network thread" : ""));
+    for (unsigned int i = 0; i < _settings.networkThreads; i++)
+    {
+        if (_settings.threadPerCore)
+        {
+            _threads.emplace_back([this, i] {
+                _pinToCore(i);
+                _shards[i]->service.run();
+            });
+        }
+        else
+            _threads.emplace_back([this] { _shards.front()->service.run(); });
+    }
+    _service.run();
+    for (auto &i : _threads)
+        i.join();
+    _threads.clear();
+    _executor.stop();
+    if (!_settings.metricsFile.empty())
+        dumpMetrics(boost::asio::error::eof);
+    std::size_t events = 0;
+    if (_tracer.events() != 0)
+    {
+        if (_tracer.write(_settings.traceFile, events))
+            Logger::info("server", std::to_string(events) + " trace events were written to " + _settings.traceFile);
+        else
+            Logger::error("server", "Trace couldn't be written to " + _settings.traceFile);
+    }
+    WriteQueue::Statistics writes = _writes.statistics();
+    std::ostringstream line;
+    line << "Writes: " << writes.writes << " (" << writes.failedWrites << " failed) in "
+              << writes.commits << " commits, largest batch " << writes.largestBatch << ", commits by batch size from:";
+    for (unsigned int i = 0; i < WriteQueue::batchSizeBuckets; i++)
+        line << ' ' << (1u << i) << ':' << writes.batchSizes[i];
+    Logger::info("server", line.str());
+    SingleFlight::Statistics flights = _flights.statistics();
+    Logger::info("server", "Reads: " + std::to_string(flights.leaders) + " run, " + std::to_string(flights.followers)
+                 + " answered by identical running reads");
+    if (_cache)
+    {
+        ResultCache::Statistics cache = _cache->statistics();
+        unsigned long long lookups = cache.hits + cache.misses;
+        line.str("");
+        line << "Result cache: " << cache.hits << " hits, " << cache.misses << " misses ("
+                  << (lookups != 0 ? cache.hits * 100 / lookups : 0) << "% hit rate), " << cache.entries << " entries of "
+                  << cache.bytes << '/' << cache.budget << " bytes, " << cache.evictions << " evicted, "
+                  << cache.invalidations << " invalidated";
+        Logger::info("server", line.str());
+    }
+}
+
+void Server::stop()
+{
+    _service.stop();
+    for (auto &i : _shards)
+        i->service.stop();
+}
+
+const Server::Settings &Server::settings() const
+{
+    return _settings;
+}
+
+unsigned short Server::port() const
+{
+    return _shards.front()->acceptor.local_endpoint().port();
+}
+
+Server::~Server()
+{
+    stop();
+    for (auto &i : _threads)
+    {
+        if (i.joinable())
+            i.join();
+    }
+}
@@ -1,11 +1,89 @@
 #ifndef SERVER_H
 #define SERVER_H
-
+#include <boost/asio.hpp>
+#include <chrono>
+#include <map>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "compressor.h"
+#include "connectionhandler.h"
+#include "connectionpool.h"
+#include "databaseexecutor.h"
+#include "metrics.h"
+#include "resultcache.h"
+#include "singleflight.h"
+#include "tracer.h"
+#include "writequeue.h"
 
 class Server
 {
+public:
+    struct Settings
+    {
+        std::string address = "0.0.0.0";
+        unsigned short port = 5555;
+        unsigned int networkThreads = 0;//0 - one per hardware thread
+        //Every network thread gets its own io_service and SO_REUSEPORT acceptor and is pinned to a core,
+        //so connections stay on the thread which accepted them. Otherwise threads share one of each
+        bool threadPerCore = false;
+        unsigned int databaseThreads = 0;//0 - one per hardware thread
+        unsigned int databaseQueueSize = 1024;//Queries waiting in one queue of the executor above this are rejected
+        //Queries wait for a database thread in a queue per client address instead of one per database
+        bool queueByClient = false;
+        DatabaseExecutor::Limits queueLimits;//Of queues not listed in queues
+        std::map<std::string, DatabaseExecutor::Limits> queues;//By database or client address
+        std::chrono::milliseconds queryTimeout = std::chrono::seconds(30);//Unless a request has its own, 0 - no limit
+        ConnectionPool::Settings pool;
+        WriteQueue::Settings writes;
+        std::size_t compressionThreshold = 4096;//Bodies shorter than this are sent uncompressed even if the client accepts compression
+        std::size_t resultCacheSize = 0;//Bytes of encoded results kept in memory, 0 disables the cache
+        std::string metricsFile;//Metrics::dump() is written to this file every metricsInterval if it is set
+        std::chrono::seconds metricsInterval = std::chrono::seconds(60);
+        unsigned int traceSampling = 0;//Every n-th request is traced from the start, 0 - tracing is off until a Trace request
+        std::string traceFile = "trace.json";//Written when tracing is stopped and on shutdown
+    };
+private:
+    struct Shard
+    {
+        boost::asio::io_service service;
+        boost::asio::ip::tcp::acceptor acceptor;
+        Shard() : acceptor(service) {}
+    };
+    Settings _settings;
+    boost::asio::io_service _service;//Signals and timers of the server itself
+    boost::asio::signal_set _signals;
+    ConnectionPool _pool;
+    DatabaseExecutor _executor;
+    std::unique_ptr<ResultCache> _cache;
+    SingleFlight _flights;
+    WriteQueue _writes;
+    Metrics _metrics;
+    Tracer _tracer;
+    Compressor _compressor;
+    ConnectionHandler::Services _services;
+    boost::asio::steady_timer _metricsTimer;
+    std::vector<std::unique_ptr<Shard>> _shards;//Destroyed first, connections use the parts above
+    std::vector<std::thread> _threads;
+    static Settings _resolved(Settings settings);
+    static void _pinToCore(unsigned int index);
+    void startAccept(Shard &shard);
+    void handleAccept(Shard &shard, ConnectionHandler::pointer connection, const boost::system::error_code &err);
+    void scheduleMetricsDump();
+    void dumpMetrics(const boost::system::error_code &err);
 public:
     Server();
+    explicit Server(const Settings &settings);
+    Server(const Server &other) = delete;
+    Server &operator = (const Server &other) = delete;
+    //Blocks until stop() is called or SIGINT/SIGTERM is received. Network threads are started by run(),
+    //the calling thread handles signals and timers of the server
+    void run();
+    void stop();
+    const Settings &settings() const;
+    unsigned short port() const;//Port the server listens on, e.g. the one chosen by the system for port 0
+    ~Server();
 };
 
 #endif // SERVER_H
@@ -0,0 +1,54 @@
+#include "singleflight.h"
+
+bool SingleFlight::join(const std::string &key, Waiter waiter)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    auto found = _flights.find(key);
+    if (found == _flights.end())
+    {
+        _flights.emplace(key, std::vector<Waiter>());
+        _statistics.leaders++;
+        return true;
+    }
+    found->second.push_back(std::move(waiter));
+    _statistics.followers++;
+    return false;
+}
+
+void SingleFlight::land(const std::string &key, const Response &response)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        auto found = _flights.find(key);
+        if (found == _flights.end())
+            return;
+        waiters.swap(found->second);
+        _flights.erase(found);
+    }
+    for (auto &i : waiters)
+        i(&response);
+}
+
+void SingleFlight::abandon(const std::string &key)
+{
+    std::vector<Waiter> waiters;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        auto found = _flights.find(key);
+        if (found == _flights.end())
+            return;
+        waiters.swap(found->second);
+        _flights.erase(found);
+        if (!waiters.empty())
+            _statistics.abandoned++;
+    }
+    for (auto &i : waiters)
+        i(nullptr);
+}
+
+SingleFlight::Statistics SingleFlight::statistics()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _statistics;
+}
@@ -0,0 +1,42 @@
+#ifndef SINGLEFLIGHT_H
+#define SINGLEFLIGHT_H
+#include <functional>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "protocol.h"
+
+//Identical reads which arrive while one of them runs are not run again: they wait for the running one
+//and are answered with its response, sharing the encoded result instead of copying it.
+class SingleFlight
+{
+public:
+    using Waiter = std::function<void(const Response *response)>;//nullptr if the read was abandoned
+    struct Statistics
+    {
+        unsigned long long leaders = 0;//Reads which were run
+        unsigned long long followers = 0;//Reads answered by a read run for another request
+        unsigned long long abandoned = 0;//Reads whose waiters had to run again
+    };
+private:
+    std::unordered_map<std::string, std::vector<Waiter>> _flights;
+    Statistics _statistics;
+    std::mutex _lock;
+public:
+    SingleFlight() = default;
+    SingleFlight(const SingleFlight &other) = delete;
+    SingleFlight &operator = (const SingleFlight &other) = delete;
+    //Returns true if no read of key runs. Caller has to run it and call land then.
+    //Otherwise waiter is called with the response of the running read
+    bool join(const std::string &key, Waiter waiter);
+    //Ends the read of key and passes its response to the waiters. Results should be in response.shared
+    void land(const std::string &key, const Response &response);
+    //Ends the read of key without a response its waiters can use, e.g. it was interrupted for its own request.
+    //Waiters are called with nullptr and have to run the read themselves
+    void abandon(const std::string &key);
+    Statistics statistics();
+};
+
+#endif // SINGLEFLIGHT_H
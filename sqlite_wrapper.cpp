@@ -1,8 +1,14 @@
 #include "sqlite_wrapper.h"
+#include "logger.h"
 #include <iostream>
 #include <chrono>
 #include <thread>
-#include <mutex>
+#include <cctype>
+#include <cstring>
+
+//Bound to statements run without parameters, so leftover ? placeholders are reported instead of being NULL
+static const std::vector<std::string> noParams;
+
 Sqlite3Exception::Sqlite3Exception(const std::string &databaseName, const std::string &details, const std::string &msg)
 {
     _msg = "Error from SQL on database ";
@@ -60,22 +66,29 @@ const char *ColumnException::what() const noexcept
 {
     return _msg.c_str();
 }
-Result Sqlite_wrapper::_result;
-bool Sqlite_wrapper::firstQuery = true;
-int Sqlite_wrapper::callback(void *, int argc, char **argv, char **azColName)
+void Sqlite_wrapper::collectRow(sqlite3_stmt *statement, Result &result)
 {
-    for (int i = 0; i < argc; i++)
+    for (int i = 0, n = result.size(); i < n; i++)
     {
-        if (firstQuery)
+        switch (sqlite3_column_type(statement, i))
         {
-            _result.resize(argc);
-            _result.addColumn(azColName[i], i);
+        case SQLITE_INTEGER:
+            result.addInteger(sqlite3_column_int64(statement, i), i);
+            break;
+        case SQLITE_FLOAT:
+            result.addFloat(sqlite3_column_double(statement, i), i);
+            break;
+        case SQLITE_TEXT:
+            result.addText(reinterpret_cast<const char *>(sqlite3_column_text(statement, i)),
+                           sqlite3_column_bytes(statement, i), i);
+            break;
+        case SQLITE_BLOB:
+            result.addBlob(sqlite3_column_blob(statement, i), sqlite3_column_bytes(statement, i), i);
+            break;
+        default:
+            result.addNull(i);
         }
-        _result.addValue(std::string(argv[i] ? argv[i] : ""), i);
     }
-    if (firstQuery)
-        firstQuery = false;
-    return 0;
 }
 
 Sqlite_wrapper::Sqlite_wrapper()
@@ -83,54 +96,393 @@ Sqlite_wrapper::Sqlite_wrapper()
     currentTable = false;
     currentColumn = false;
     sqlite3Errmsg = nullptr;
+    cursor = nullptr;
+    cursorCached = false;
+    deadline = Clock::time_point::max();
+    cancelled = nullptr;
+    interrupted = NotInterrupted;
 }
 
-void Sqlite_wrapper::_modifyingExec(ParamString &query)
+void Sqlite_wrapper::_exec(ParamString &query, bool collectRows, ParamVector *params)
 {
-    int status;
-    status = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &sqlite3Errmsg);
-    while (status == SQLITE_BUSY)
+    std::string sql = StatementCache::normalize(query);
+    sqlite3_stmt *statement = statements.get(sql);
+    if (statement != nullptr)
     {
-        sqlite3_free(sqlite3Errmsg);
-        std::this_thread::sleep_for(std::chrono::seconds(5));
-        status = sqlite3_exec(db, query.c_str(), nullptr, nullptr, &sqlite3Errmsg);
+        _bind(statement, query, params != nullptr ? *params : noParams);
+        _step(statement, query, collectRows);
+        return;
     }
-    if (status != SQLITE_OK)
+    const char *tail = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), static_cast<int>(sql.size()) + 1, &statement, &tail) != SQLITE_OK)
+        throw Sqlite3Exception(curTable.databaseName, query, sqlite3_errmsg(db));
+    while (tail != nullptr && std::isspace(static_cast<unsigned char>(*tail)))
+        tail++;
+    if (tail == nullptr || *tail == '\0')
     {
-        std::string msg = std::move(sqlite3Errmsg);
-        sqlite3_free(sqlite3Errmsg);
-        throw Sqlite3Exception(curTable.databaseName, query, msg);
+        if (statement == nullptr)//Query contained only whitespace or comments
+            return;
+        bool cached = statements.put(sql, statement);
+        try {
+            _bind(statement, query, params != nullptr ? *params : noParams);
+            _step(statement, query, collectRows);
+        } catch (std::exception &) {
+            if (!cached)
+                sqlite3_finalize(statement);
+            throw;
+        }
+        if (!cached)
+            sqlite3_finalize(statement);
+        return;
+    }
+    if (params != nullptr)
+    {
+        sqlite3_finalize(statement);
+        throw Sqlite3Exception(curTable.databaseName, query, "Parameters can be bound to a single statement only");
+    }
+    //Scripts with several statements are run one by one and are not cached
+    while (true)
+    {
+        if (statement != nullptr)
+        {
+            try {
+                _bind(statement, query, noParams);
+                _step(statement, query, collectRows);
+            } catch (std::exception &) {
+                sqlite3_finalize(statement);
+                throw;
+            }
+            sqlite3_finalize(statement);
+        }
+        while (std::isspace(static_cast<unsigned char>(*tail)))
+            tail++;
+        if (*tail == '\0')
+            break;
+        if (sqlite3_prepare_v2(db, tail, -1, &statement, &tail) != SQLITE_OK)
+            throw Sqlite3Exception(curTable.databaseName, query, sqlite3_errmsg(db));
     }
 }
 
-void Sqlite_wrapper::_readExec(ParamString &query)
+bool Sqlite_wrapper::_readsOnly(ParamString &query)
 {
-    _result.clear();
-    result.clear();
-    firstQuery = true;
+    std::string sql = StatementCache::normalize(query);
+    sqlite3_stmt *statement = statements.get(sql);
+    if (statement != nullptr)
+        return sqlite3_stmt_readonly(statement) != 0;
+    const char *tail = sql.c_str();
+    bool first = true, readOnly = true;
+    while (readOnly)
+    {
+        while (std::isspace(static_cast<unsigned char>(*tail)))
+            tail++;
+        if (*tail == '\0')
+            break;
+        //Statements which can't be prepared here, e.g. ones using a table created earlier in the script, are left to the writer
+        if (sqlite3_prepare_v2(db, tail, -1, &statement, &tail) != SQLITE_OK)
+            return false;
+        if (statement == nullptr)
+            continue;
+        readOnly = sqlite3_stmt_readonly(statement) != 0;
+        while (std::isspace(static_cast<unsigned char>(*tail)))
+            tail++;
+        //A single reading statement will be run on this connection right after this, so it is kept prepared
+        if (!(first && readOnly && *tail == '\0' && statements.put(sql, statement)))
+            sqlite3_finalize(statement);
+        first = false;
+    }
+    return readOnly;
+}
+
+int Sqlite_wrapper::authorizer(void *access, int action, const char *arg1, const char *arg2, const char *database, const char *)
+{
+    TableAccess &_access = *static_cast<TableAccess *>(access);
+    const char *table = nullptr;
+    switch (action)
+    {
+    case SQLITE_READ:
+        table = _access.written ? nullptr : arg1;
+        break;
+    case SQLITE_INSERT:
+    case SQLITE_UPDATE:
+    case SQLITE_DELETE:
+        table = _access.written ? arg1 : nullptr;
+        break;
+    case SQLITE_PRAGMA:
+        //What a PRAGMA reports isn't kept in tables, so no write would drop its cached result
+        _access.deterministic = false;
+        break;
+    case SQLITE_FUNCTION:
+    {
+        static const char *volatileFunctions[] = {"random", "randomblob", "changes", "total_changes", "last_insert_rowid",
+                                                  "date", "time", "datetime", "julianday", "strftime", "unixepoch"};
+        std::string name = arg2 != nullptr ? arg2 : "";
+        for (auto &c : name)
+            c = std::tolower(static_cast<unsigned char>(c));
+        for (auto i : volatileFunctions)
+        {
+            if (name == i)
+                _access.deterministic = false;
+        }
+        break;
+    }
+    }
+    if (table != nullptr)
+    {
+        //Tables of temp or attached databases belong to the connection rather than to the file
+        if (database != nullptr && std::strcmp(database, "main") != 0)
+            _access.deterministic = false;
+        std::string name = table;
+        for (auto &c : name)
+            c = std::tolower(static_cast<unsigned char>(c));
+        _access.tables->insert(std::move(name));
+    }
+    return SQLITE_OK;
+}
+
+int Sqlite_wrapper::progressHandler(void *connection)
+{
+    Sqlite_wrapper *wrapper = static_cast<Sqlite_wrapper *>(connection);
+    if (wrapper->cancelled != nullptr && wrapper->cancelled->load(std::memory_order_relaxed))
+        wrapper->interrupted = Cancelled;
+    else if (wrapper->deadline != Clock::time_point::max() && Clock::now() >= wrapper->deadline)
+        wrapper->interrupted = DeadlineExceeded;
+    //Non zero makes the running statement fail with SQLITE_INTERRUPT
+    return wrapper->interrupted != NotInterrupted;
+}
+
+void Sqlite_wrapper::updateHook(void *connection, int, const char *, const char *table, sqlite3_int64)
+{
+    std::string name = table;
+    for (auto &c : name)
+        c = std::tolower(static_cast<unsigned char>(c));
+    static_cast<Sqlite_wrapper *>(connection)->changedTables.insert(std::move(name));
+}
+
+bool Sqlite_wrapper::tablesOf(ParamString &query, bool written, std::set<std::string> &tables)
+{
+    //Authorizer is called while statements are compiled, so they are prepared again instead of being taken from the cache
+    TableAccess access{&tables, written, true};
+    std::string sql = StatementCache::normalize(query);
+    const char *tail = sql.c_str();
+    bool prepared = true;
+    sqlite3_set_authorizer(db, &Sqlite_wrapper::authorizer, &access);
+    while (prepared)
+    {
+        while (std::isspace(static_cast<unsigned char>(*tail)))
+            tail++;
+        if (*tail == '\0')
+            break;
+        sqlite3_stmt *statement = nullptr;
+        prepared = sqlite3_prepare_v2(db, tail, -1, &statement, &tail) == SQLITE_OK;
+        sqlite3_finalize(statement);
+    }
+    sqlite3_set_authorizer(db, nullptr, nullptr);
+    return prepared && (written || access.deterministic);
+}
+
+void Sqlite_wrapper::_openCursor(ParamString &query, ParamVector *params)
+{
+    _closeCursor();
+    std::string sql = StatementCache::normalize(query);
+    sqlite3_stmt *statement = statements.get(sql);
+    bool cached = true;
+    if (statement == nullptr)
+    {
+        const char *tail = nullptr;
+        if (sqlite3_prepare_v2(db, sql.c_str(), static_cast<int>(sql.size()) + 1, &statement, &tail) != SQLITE_OK)
+            throw Sqlite3Exception(curTable.databaseName, query, sqlite3_errmsg(db));
+        while (tail != nullptr && std::isspace(static_cast<unsigned char>(*tail)))
+            tail++;
+        if (tail != nullptr && *tail != '\0')
+        {
+            sqlite3_finalize(statement);
+            throw Sqlite3Exception(curTable.databaseName, query, "Only a single statement can be read with a cursor");
+        }
+        if (statement == nullptr)
+            throw Sqlite3Exception(curTable.databaseName, query, "Query is empty");
+        cached = statements.put(sql, statement);
+    }
+    cursor = statement;
+    cursorCached = cached;
+    cursorQuery = query;
+    _bind(cursor, query, params != nullptr ? *params : noParams);
+}
+
+bool Sqlite_wrapper::_fetch(int (*callback)(void *, int, char **, char **), void *context)
+{
+    if (cursor == nullptr)
+        return false;
+    int argc = sqlite3_column_count(cursor);
+    std::vector<char *> argv(argc), azColName(argc);
+    for (int i = 0; i < argc; i++)
+        azColName[i] = const_cast<char *>(sqlite3_column_name(cursor, i));
     int status;
-    auto _callback = Sqlite_wrapper::callback;
-    if ((status = sqlite3_exec(db, query.c_str(), _callback, nullptr, &sqlite3Errmsg)) != SQLITE_OK)
+    while ((status = sqlite3_step(cursor)) == SQLITE_ROW)
+    {
+        for (int i = 0; i < argc; i++)
+            argv[i] = reinterpret_cast<char *>(const_cast<unsigned char *>(sqlite3_column_text(cursor, i)));
+        if (callback(context, argc, argv.data(), azColName.data()) != 0)
+            return true;
+    }
+    if (status != SQLITE_DONE)
+        throw Sqlite3Exception(curTable.databaseName, cursorQuery, sqlite3_errmsg(db));
+    _closeCursor();
+    return false;
+}
+
+bool Sqlite_wrapper::_fetch(Result &rows, std::size_t maxBytes)
+{
+    rows.clear();
+    if (cursor == nullptr)
+        return false;
+    int status = sqlite3_step(cursor);
+    int columns = sqlite3_column_count(cursor);
+    rows.resize(columns);
+    for (int i = 0; i < columns; i++)
+        rows.addColumn(sqlite3_column_name(cursor, i), i);
+    std::size_t bytes = 0;
+    for (; status == SQLITE_ROW; status = sqlite3_step(cursor))
+    {
+        collectRow(cursor, rows);
+        //sqlite3_column_bytes would convert numbers to text, they take 8 bytes in the binary format anyway
+        for (int i = 0; i < columns; i++)
+        {
+            int type = sqlite3_column_type(cursor, i);
+            bytes += 8 + (type == SQLITE_TEXT || type == SQLITE_BLOB ? sqlite3_column_bytes(cursor, i) : 0);
+        }
+        if (bytes >= maxBytes)
+            return true;
+    }
+    if (status != SQLITE_DONE)
+        throw Sqlite3Exception(curTable.databaseName, cursorQuery, sqlite3_errmsg(db));
+    _closeCursor();
+    return false;
+}
+
+void Sqlite_wrapper::_closeCursor()
+{
+    if (cursor == nullptr)
+        return;
+    if (cursorCached)
+    {
+        sqlite3_reset(cursor);
+        sqlite3_clear_bindings(cursor);
+    }
+    else
+        sqlite3_finalize(cursor);
+    cursor = nullptr;
+}
+
+void Sqlite_wrapper::_bind(sqlite3_stmt *statement, ParamString &query, ParamVector &params)
+{
+    int count = sqlite3_bind_parameter_count(statement);
+    if (count != static_cast<int>(params.size()))
+        throw Sqlite3Exception(curTable.databaseName, query, "Expected " + std::to_string(count) + " parameters but "
+                               + std::to_string(params.size()) + " were provided");
+    //Values are copied: a cursor steps after the call returned and bindings are cleared only once a statement is reset
+    for (int i = 0; i < count; i++)
     {
-        std::string msg = std::move(sqlite3Errmsg);
-        sqlite3_free(sqlite3Errmsg);
+        if (sqlite3_bind_text(statement, i + 1, params[i].c_str(), static_cast<int>(params[i].size()), SQLITE_TRANSIENT) != SQLITE_OK)
+            throw Sqlite3Exception(curTable.databaseName, query, sqlite3_errmsg(db));
+    }
+}
+
+void Sqlite_wrapper::_step(sqlite3_stmt *statement, ParamString &query, bool collectRows)
+{
+    //Columns are known after the first step, statements prepared before a schema change are compiled again by it
+    int status = sqlite3_step(statement);
+    int columns = sqlite3_column_count(statement);
+    if (collectRows && result.size() == 0 && columns != 0)
+    {
+        result.resize(columns);
+        for (int i = 0; i < columns; i++)
+            result.addColumn(sqlite3_column_name(statement, i), i);
+    }
+    //Rows of a script are collected only from statements with the columns of the first one
+    collectRows = collectRows && columns == static_cast<int>(result.size());
+    for (; status == SQLITE_ROW; status = sqlite3_step(statement))
+    {
+        if (collectRows)
+            collectRow(statement, result);
+    }
+    if (status != SQLITE_DONE)
+    {
+        std::string msg = sqlite3_errmsg(db);
+        sqlite3_reset(statement);
+        sqlite3_clear_bindings(statement);
         throw Sqlite3Exception(curTable.databaseName, query, msg);
     }
+    sqlite3_reset(statement);
+    sqlite3_clear_bindings(statement);
+}
+
+void Sqlite_wrapper::_modifyingExec(ParamString &query)
+{
+    _exec(query, false);
+}
+
+void Sqlite_wrapper::_modifyingExec(ParamString &query, ParamVector &params)
+{
+    _exec(query, false, &params);
+}
+
+void Sqlite_wrapper::_modifyingExecBatch(ParamString &query, ParamRows &rows)
+{
+    //Inside of a transaction opened by the client the batch becomes a savepoint of it
+    bool ownTransaction = sqlite3_get_autocommit(db) != 0;
+    result.clear();
+    _exec(ownTransaction ? "begin immediate" : "savepoint batch", false);
+    try {
+        for (auto &row : rows)
+            _exec(query, true, &row);
+        _exec(ownTransaction ? "commit" : "release batch", false);
+    } catch (std::exception &) {
+        sqlite3_exec(db, ownTransaction ? "rollback" : "rollback to batch; release batch", nullptr, nullptr, nullptr);
+        throw;
+    }
+}
+
+void Sqlite_wrapper::_readExec(ParamString &query)
+{
+    result.clear();
+    _exec(query, true);
 }
 
-void Sqlite_wrapper::_createDatabase(ParamString &fileName)
+void Sqlite_wrapper::_readExec(ParamString &query, ParamVector &params)
+{
+    result.clear();
+    _exec(query, true, &params);
+}
+
+void Sqlite_wrapper::_createDatabase(ParamString &fileName, bool readOnly, const OpenProfile &profile)
 {
     if (fileName == "")
         throw CreateDatabaseException("Filename wasn't provided");
     std::string path = std::move(fileName);
     curTable.databaseName = path.substr(path.find_last_of('/') + 1, path.length());
-    if (fileName.substr(fileName.length()-3, fileName.length()) != ".db")
+    if (path.length() < 3 || path.compare(path.length() - 3, 3, ".db") != 0)
     {
         path += ".db";
     }
+    //A connection is used by one thread at a time, so SQLite's own per-connection mutex is not needed
     int status;
-    if ((status = sqlite3_open(path.c_str(), &db)))
+    int flags = (readOnly ? SQLITE_OPEN_READONLY : SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE) | SQLITE_OPEN_NOMUTEX | profile.flags;
+    if ((status = sqlite3_open_v2(path.c_str(), &db, flags, nullptr)))
         throw Sqlite3Exception(curTable.databaseName, path, sqlite3_errmsg(db));
+    //page_size of a new database has to be set before WAL mode creates its first page
+    for (auto &pragma : profile.pragmas)
+    {
+        std::string query = "pragma " + pragma.first + "=" + pragma.second;
+        if (sqlite3_exec(db, query.c_str(), nullptr, nullptr, nullptr) != SQLITE_OK)
+            throw Sqlite3Exception(curTable.databaseName, query, sqlite3_errmsg(db));
+    }
+    //In WAL mode readers see the last commit and don't wait for the writer. Mode is stored in the file,
+    //so read-only connections get it from the read-write one which opened the database first
+    if (!readOnly)
+        sqlite3_exec(db, "pragma journal_mode=wal", nullptr, nullptr, nullptr);
+    //Writes of this server are serialized by WriteQueue, so the lock is held by other processes only.
+    //SQLite retries with growing pauses instead of failing at once with SQLITE_BUSY
+    sqlite3_busy_timeout(db, busyTimeout);
 }
 
 void Sqlite_wrapper::_createTable(ParamString &table)
@@ -233,14 +585,15 @@ void Sqlite_wrapper::_getID(ParamString &IDName, ParamString &table, ParamString
     query += std::move(table);
     query += " where ";
     query += std::move(columnName);
-    query += " = ";
-    query += '\'' + std::move(value) + '\'';
+    query += " = ?";
 
-    _readExec(query);
+    _readExec(query, ParamVector{value});
 }
 
 void Sqlite_wrapper::_disconnectFromDatabase()
 {
+    _closeCursor();
+    statements.clear();
     int status;
     if ((status = sqlite3_close(db)) == SQLITE_BUSY)
         throw Sqlite3Exception(curTable.databaseName, "", sqlite3_errmsg(db));
@@ -248,17 +601,18 @@ void Sqlite_wrapper::_disconnectFromDatabase()
 
 void Sqlite_wrapper::sqlite3ExceptionHandler(std::exception &e)
 {
-    std::cerr << e.what() << std::endl;
+    lastError = e.what();
+    Logger::error("sqlite", lastError);
 }
 
 void Sqlite_wrapper::sqlite3BusyExceptionHandler(std::exception &e)
 {
     int count = 1;
-    std::cerr << e.what() << std::endl;
+    Logger::error("sqlite", e.what());
     std::this_thread::sleep_for(std::chrono::seconds(5));
     try {
         count++;
-        std::cerr << "Attempt to close connection to database #" << count << std::endl;
+        Logger::warning("sqlite", "Attempt to close connection to database #" + std::to_string(count));
         _disconnectFromDatabase();
     } catch (std::exception &e) {
         sqlite3BusyExceptionHandler(e);
@@ -267,71 +621,76 @@ void Sqlite_wrapper::sqlite3BusyExceptionHandler(std::exception &e)
 
 void Sqlite_wrapper::createDatabaseExceptionHandler(std::exception &e)
 {
-    std::cerr << "createDatabase(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("createDatabase(): ") + e.what());
 }
 
 void Sqlite_wrapper::createTableExceptionHandler(std::exception &e)
 {
-    std::cerr << "createTable(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("createTable(): ") + e.what());
 }
 
 void Sqlite_wrapper::createColumnExceptionHandler(std::exception &e)
 {
-    std::cerr << "createColumn(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("createColumn(): ") + e.what());
 }
 
 void Sqlite_wrapper::setPKExceptionHandler(std::exception &e)
 {
-    std::cerr << "setAsPK(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("setAsPK(): ") + e.what());
 }
 
 void Sqlite_wrapper::setUniqueExceptionHandler(std::exception &e)
 {
-    std::cerr << "setUnique(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("setUnique(): ") + e.what());
 }
 
 void Sqlite_wrapper::setDefaultValueExceptionHandler(std::exception &e)
 {
-    std::cerr << "setDefaultValue(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("setDefaultValue(): ") + e.what());
 }
 
 void Sqlite_wrapper::addColumnExceptionHandler(std::exception &e)
 {
-    std::cerr << "addcolumn(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("addcolumn(): ") + e.what());
 }
 
 void Sqlite_wrapper::setForeignKeyExceptionHandler(std::exception &e)
 {
-    std::cerr << "setForeignKey(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("setForeignKey(): ") + e.what());
 }
 
 void Sqlite_wrapper::addTableExceptionHandler(std::exception &e)
 {
-     std::cerr << "addTable(): " << e.what() << std::endl;
+     Logger::error("sqlite", std::string("addTable(): ") + e.what());
      curTable.clear();
      currentTable = false;
 }
 
 void Sqlite_wrapper::insertExceptionHandler(std::exception &e)
 {
-    std::cerr << "insertInto(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("insertInto(): ") + e.what());
 }
 
 void Sqlite_wrapper::selectFromExceptionHandler(std::exception &e)
 {
-    std::cerr << "selectFrom(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("selectFrom(): ") + e.what());
 }
 
 void Sqlite_wrapper::updateExceptionHandler(std::exception &e)
 {
-    std::cerr << "updateTable(): " << e.what() << std::endl;
+    Logger::error("sqlite", std::string("updateTable(): ") + e.what());
+}
+
+Sqlite_wrapper *Sqlite_wrapper::connectToDatabase(ParamString &fileName, bool readOnly)
+{
+    return connectToDatabase(fileName, readOnly, OpenProfile());
 }
 
-Sqlite_wrapper *Sqlite_wrapper::connectToDatabase(ParamString &fileName)
+Sqlite_wrapper *Sqlite_wrapper::connectToDatabase(ParamString &fileName, bool readOnly, const OpenProfile &profile)
 {
     Sqlite_wrapper *temp = new Sqlite_wrapper();
     try {
-        temp->_createDatabase(fileName);
+        temp->_createDatabase(fileName, readOnly, profile);
     } catch (std::exception &e) {
         temp->createDatabaseExceptionHandler(e);
         delete temp;
@@ -421,7 +780,7 @@ void Sqlite_wrapper::addTable()
 
 void Sqlite_wrapper::printToShell(const Result &result)
 {
-    if (result.size() == 0)
+    if (result.rows() == 0)
         std::cout << "No rows were selected" << std::endl;
     else
         std::cout << result.resultToString() << std::endl;
@@ -436,10 +795,10 @@ std::string Sqlite_wrapper::getID(ParamString &table, ParamString &columnName, P
         _IDName = std::move(IDName);
     try {
         _getID(_IDName, table, columnName, value);
-        if (_result.size() == 0)
+        if (result.rows() == 0)
             ID = "";
         else
-            ID = _result.valueAt(0, 0);
+            ID = result.valueAt(0, 0);
     } catch (std::exception &e) {
         sqlite3ExceptionHandler(e);
     }
@@ -449,6 +808,7 @@ std::string Sqlite_wrapper::getID(ParamString &table, ParamString &columnName, P
 
 void Sqlite_wrapper::modifyingExec(ParamString &query)
 {
+    lastError.clear();
     try {
         _modifyingExec(query);
     } catch (std::exception &e) {
@@ -456,29 +816,223 @@ void Sqlite_wrapper::modifyingExec(ParamString &query)
     }
 }
 
+void Sqlite_wrapper::modifyingExec(ParamString &query, ParamVector &params)
+{
+    lastError.clear();
+    try {
+        _modifyingExec(query, params);
+    } catch (std::exception &e) {
+        sqlite3ExceptionHandler(e);
+    }
+}
+
+void Sqlite_wrapper::modifyingExecBatch(ParamString &query, ParamRows &rows)
+{
+    lastError.clear();
+    try {
+        _modifyingExecBatch(query, rows);
+    } catch (std::exception &e) {
+        sqlite3ExceptionHandler(e);
+    }
+}
+
 Result &Sqlite_wrapper::readExec(ParamString &query)
 {
-    std::mutex lock;
+    lastError.clear();
     try {
-        lock.lock();
         curTable.name.clear();
         _readExec(query);
-        firstQuery = true;
-        if (_result.size() != 0)
-            result = std::move(_result);
-        lock.unlock();
     } catch (std::exception &e) {
-        lock.unlock();
         sqlite3ExceptionHandler(e);
     }
     return result;
 }
 
+Result &Sqlite_wrapper::readExec(ParamString &query, ParamVector &params)
+{
+    lastError.clear();
+    try {
+        curTable.name.clear();
+        _readExec(query, params);
+    } catch (std::exception &e) {
+        sqlite3ExceptionHandler(e);
+    }
+    return result;
+}
+
+bool Sqlite_wrapper::openCursor(ParamString &query)
+{
+    lastError.clear();
+    try {
+        _openCursor(query, nullptr);
+    } catch (std::exception &e) {
+        _closeCursor();
+        sqlite3ExceptionHandler(e);
+        return false;
+    }
+    return true;
+}
+
+bool Sqlite_wrapper::openCursor(ParamString &query, ParamVector &params)
+{
+    lastError.clear();
+    try {
+        _openCursor(query, &params);
+    } catch (std::exception &e) {
+        _closeCursor();
+        sqlite3ExceptionHandler(e);
+        return false;
+    }
+    return true;
+}
+
+std::vector<std::string> Sqlite_wrapper::cursorColumns() const
+{
+    std::vector<std::string> columns;
+    if (cursor == nullptr)
+        return columns;
+    int count = sqlite3_column_count(cursor);
+    columns.reserve(count);
+    for (int i = 0; i < count; i++)
+        columns.push_back(sqlite3_column_name(cursor, i));
+    return columns;
+}
+
+bool Sqlite_wrapper::fetch(int (*callback)(void *, int, char **, char **), void *context)
+{
+    lastError.clear();
+    try {
+        return _fetch(callback, context);
+    } catch (std::exception &e) {
+        _closeCursor();
+        sqlite3ExceptionHandler(e);
+    }
+    return false;
+}
+
+bool Sqlite_wrapper::fetch(Result &rows, std::size_t maxBytes)
+{
+    lastError.clear();
+    try {
+        return _fetch(rows, maxBytes);
+    } catch (std::exception &e) {
+        _closeCursor();
+        sqlite3ExceptionHandler(e);
+    }
+    return false;
+}
+
+void Sqlite_wrapper::closeCursor()
+{
+    _closeCursor();
+}
+
 Result &Sqlite_wrapper::getLastResult()
 {
     return result;
 }
 
+const std::string &Sqlite_wrapper::getLastError() const
+{
+    return lastError;
+}
+
+bool Sqlite_wrapper::readsOnly(ParamString &query)
+{
+    lastError.clear();
+    try {
+        return _readsOnly(query);
+    } catch (std::exception &e) {
+        sqlite3ExceptionHandler(e);
+    }
+    return false;
+}
+
+void Sqlite_wrapper::trackChanges(bool track)
+{
+    if (track)
+        sqlite3_update_hook(db, &Sqlite_wrapper::updateHook, this);
+    else
+        sqlite3_update_hook(db, nullptr, nullptr);
+    changedTables.clear();
+}
+
+std::set<std::string> Sqlite_wrapper::takeChangedTables()
+{
+    std::set<std::string> tables;
+    tables.swap(changedTables);
+    return tables;
+}
+
+int Sqlite_wrapper::schemaVersion()
+{
+    sqlite3_stmt *statement = nullptr;
+    int version = -1;
+    if (sqlite3_prepare_v2(db, "pragma schema_version", -1, &statement, nullptr) == SQLITE_OK
+            && sqlite3_step(statement) == SQLITE_ROW)
+        version = sqlite3_column_int(statement, 0);
+    sqlite3_finalize(statement);
+    return version;
+}
+
+std::string Sqlite_wrapper::pragma(ParamString &name)
+{
+    sqlite3_stmt *statement = nullptr;
+    std::string value;
+    std::string query = "pragma " + name;
+    if (sqlite3_prepare_v2(db, query.c_str(), -1, &statement, nullptr) == SQLITE_OK
+            && sqlite3_step(statement) == SQLITE_ROW && sqlite3_column_text(statement, 0) != nullptr)
+        value = reinterpret_cast<const char *>(sqlite3_column_text(statement, 0));
+    sqlite3_finalize(statement);
+    return value;
+}
+
+bool Sqlite_wrapper::isReadOnly() const
+{
+    return sqlite3_db_readonly(db, "main") == 1;
+}
+
+bool Sqlite_wrapper::inTransaction() const
+{
+    return sqlite3_get_autocommit(db) == 0;
+}
+
+void Sqlite_wrapper::setInterruption(Clock::time_point deadline, const std::atomic<bool> *cancelled)
+{
+    this->deadline = deadline;
+    this->cancelled = cancelled;
+    interrupted = NotInterrupted;
+    bool needed = deadline != Clock::time_point::max() || cancelled != nullptr;
+    sqlite3_progress_handler(db, needed ? progressSteps : 0, needed ? &Sqlite_wrapper::progressHandler : nullptr, this);
+}
+
+void Sqlite_wrapper::clearInterruption()
+{
+    deadline = Clock::time_point::max();
+    cancelled = nullptr;
+    sqlite3_progress_handler(db, 0, nullptr, nullptr);
+}
+
+Sqlite_wrapper::Interruption Sqlite_wrapper::interruption() const
+{
+    return interrupted;
+}
+
+bool Sqlite_wrapper::checkConnection()
+{
+    return sqlite3_exec(db, "select 1", nullptr, nullptr, nullptr) == SQLITE_OK;
+}
+
+void Sqlite_wrapper::setStatementCacheSize(unsigned int size)
+{
+    statements.setCapacity(size);
+}
+
+StatementCache::Statistics Sqlite_wrapper::statementCacheStatistics() const
+{
+    return statements.statistics();
+}
+
 void Sqlite_wrapper::disconnectFromDatabase()
 {
     try {
@@ -1,16 +1,22 @@
 #ifndef SQLITE_WRAPPER_H
 #define SQLITE_WRAPPER_H
 #include <sqlite3.h>
+#include <atomic>
+#include <chrono>
 #include <exception>
 #include <string>
 #include <queue>
+#include <set>
+#include <utility>
 #include <vector>
 #include <memory>
 
 #include "result.h"
+#include "statementcache.h"
 
 using ParamVector = const std::vector<std::string>;
 using ParamString = const std::string;
+using ParamRows = const std::vector<std::vector<std::string>>;
 
 //Exceptions
 class Sqlite3Exception : public std::exception
@@ -56,6 +62,17 @@ public:
 
 class Sqlite_wrapper
 {
+public:
+    using Clock = std::chrono::steady_clock;
+    enum Interruption {NotInterrupted, DeadlineExceeded, Cancelled};
+    //Flags added to the open flags of the connection and PRAGMAs run right after it is opened,
+    //before the database is switched to WAL mode. Names and values are not checked here
+    struct OpenProfile
+    {
+        int flags = 0;
+        std::vector<std::pair<std::string, std::string>> pragmas;
+    };
+private:
     Sqlite_wrapper();
     Sqlite_wrapper(const Sqlite_wrapper &other) = delete;
     Sqlite_wrapper(const Sqlite_wrapper &&other) = delete;
@@ -63,8 +80,9 @@ class Sqlite_wrapper
     Sqlite_wrapper& operator=(const Sqlite_wrapper &&other) = delete;
     sqlite3 *db;
     char *sqlite3Errmsg;
-    static bool firstQuery;
-    static int callback(void*, int argc, char **argv, char **azColName);
+    enum {busyTimeout = 5000};//Milliseconds to wait for a lock held by another process
+    enum {progressSteps = 1000};//Virtual machine instructions between checks of the deadline
+    static void collectRow(sqlite3_stmt *statement, Result &result);
     struct Column
     {
         std::string name;
@@ -102,13 +120,41 @@ class Sqlite_wrapper
     Table curTable;
     bool currentTable;
 
-    static Result _result;
     Result result;
+    std::string lastError;
+    StatementCache statements;
+    sqlite3_stmt *cursor;//Statement being read by fetch()
+    bool cursorCached;
+    std::string cursorQuery;
+    std::set<std::string> changedTables;//Tables changed since takeChangedTables() while changes are tracked
+    struct TableAccess
+    {
+        std::set<std::string> *tables;
+        bool written;
+        bool deterministic;
+    };
+    static int authorizer(void *access, int action, const char *arg1, const char *arg2, const char *database, const char *trigger);
+    static void updateHook(void *connection, int operation, const char *database, const char *table, sqlite3_int64 rowid);
+    Clock::time_point deadline;
+    const std::atomic<bool> *cancelled;
+    Interruption interrupted;
+    static int progressHandler(void *connection);
 
+    void _exec(ParamString &query, bool collectRows, ParamVector *params = nullptr);
+    void _bind(sqlite3_stmt *statement, ParamString &query, ParamVector &params);
+    void _step(sqlite3_stmt *statement, ParamString &query, bool collectRows);
+    bool _readsOnly(ParamString &query);
+    void _openCursor(ParamString &query, ParamVector *params);
+    bool _fetch(int (*callback)(void *, int, char **, char **), void *context);
+    bool _fetch(Result &rows, std::size_t maxBytes);
+    void _closeCursor();
 
     void _modifyingExec(ParamString &query);
+    void _modifyingExec(ParamString &query, ParamVector &params);
+    void _modifyingExecBatch(ParamString &query, ParamRows &rows);
     void _readExec(ParamString &query);
-    void _createDatabase(ParamString &fileName);
+    void _readExec(ParamString &query, ParamVector &params);
+    void _createDatabase(ParamString &fileName, bool readOnly, const OpenProfile &profile);
     void _createTable(ParamString &table);
     void _createColumn(ParamString &column, ParamString &type);
     void _setAsPK();
@@ -139,7 +185,9 @@ protected:
     virtual void selectFromExceptionHandler(std::exception &e);
     virtual void updateExceptionHandler(std::exception &e);
 public:
-    static Sqlite_wrapper *connectToDatabase(ParamString &fileName);
+    //Read-write connections switch the database to WAL mode. Read-only ones can't create the file
+    static Sqlite_wrapper *connectToDatabase(ParamString &fileName, bool readOnly = false);
+    static Sqlite_wrapper *connectToDatabase(ParamString &fileName, bool readOnly, const OpenProfile &profile);
     void createTable(ParamString &table);
     void createColumn(ParamString &column, ParamString &type);
     void setAsPK();
@@ -154,8 +202,48 @@ public:
 
     std::string getID(ParamString &table, ParamString &columnName, ParamString &value, ParamString &IDName = "");
     void modifyingExec(ParamString &query);
+    //Values are bound to ?, ?NNN, :name, @name or $name parameters in the order they appear in the query
+    void modifyingExec(ParamString &query, ParamVector &params);
+    //Runs query once for every row of parameters inside of a single transaction. Nothing is applied on error.
+    //Rows the statements return, e.g. with RETURNING, are collected into getLastResult()
+    void modifyingExecBatch(ParamString &query, ParamRows &rows);
+    //Collects rows of the statements of query. Nothing stops them from changing the database, e.g. INSERT ... RETURNING
     Result &readExec(ParamString &query);
+    Result &readExec(ParamString &query, ParamVector &params);
+    //Cursor reads rows of a single statement a few at a time instead of collecting the whole result.
+    //fetch passes rows to callback like sqlite3_exec does until it returns non zero or rows are over.
+    //It returns true while more rows may follow. Cursor is closed when rows are over or on error.
+    bool openCursor(ParamString &query);
+    bool openCursor(ParamString &query, ParamVector &params);
+    std::vector<std::string> cursorColumns() const;
+    bool fetch(int (*callback)(void *, int, char **, char **), void *context);
+    //Replaces rows with the next typed rows of the cursor, about maxBytes of values at most
+    bool fetch(Result &rows, std::size_t maxBytes);
+    void closeCursor();
     Result &getLastResult();
+    //Message of the error reported by the last readExec or modifyingExec call. Empty if it succeeded
+    const std::string &getLastError() const;
+    //True if every statement of query leaves the database unchanged. Statements are prepared, not run
+    bool readsOnly(ParamString &query);
+    bool isReadOnly() const;//Connection was opened read-only
+    //Collects names of tables which query reads, or changes if written is true. Statements are prepared, not run.
+    //Returns false if query can't be prepared or a read depends on more than tables, e.g. uses random()
+    bool tablesOf(ParamString &query, bool written, std::set<std::string> &tables);
+    //Changed tables are recorded by sqlite3_update_hook, so changes of WITHOUT ROWID tables and DELETE without WHERE are not
+    void trackChanges(bool track);
+    std::set<std::string> takeChangedTables();
+    int schemaVersion();//-1 on error
+    std::string pragma(ParamString &name);//Current value of a PRAGMA without arguments, empty on error
+    bool inTransaction() const;
+    //Statements are interrupted once deadline passes or *cancelled becomes true, until clearInterruption().
+    //Either can be left out: Clock::time_point::max() and nullptr
+    void setInterruption(Clock::time_point deadline, const std::atomic<bool> *cancelled);
+    void clearInterruption();
+    //Why the last statement was interrupted, NotInterrupted if it wasn't. Reset by setInterruption()
+    Interruption interruption() const;
+    bool checkConnection();//Cheap round trip to check that connection is still usable
+    void setStatementCacheSize(unsigned int size);
+    StatementCache::Statistics statementCacheStatistics() const;
     //If IDName is not provided the IDName will be automatically set to table name with ID ending.
     //E.g. If table name is Test then IDName will be set to TestID
     void disconnectFromDatabase();
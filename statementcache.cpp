@@ -0,0 +1,114 @@
+#include "statementcache.h"
+#include <cctype>
+
+StatementCache::StatementCache(unsigned int capacity) : _capacity(capacity), _hits(0), _misses(0)
+{
+
+}
+
+std::string StatementCache::normalize(const std::string &sql)
+{
+    std::string normalized;
+    normalized.reserve(sql.size());
+    char quote = 0;
+    bool space = false;
+    for (std::string::size_type i = 0, n = sql.size(); i < n; i++)
+    {
+        char c = sql[i];
+        if (quote)
+        {
+            normalized += c;
+            if (c == quote)
+                quote = 0;
+            continue;
+        }
+        if (c == '\'' || c == '"' || c == '`' || c == '[')
+        {
+            quote = c == '[' ? ']' : c;
+        }
+        else if ((c == '-' && i + 1 < n && sql[i + 1] == '-') || (c == '/' && i + 1 < n && sql[i + 1] == '*'))
+        {
+            //Folding lines would change the meaning of comments, so such text is kept as is
+            normalized.append(sql, i, std::string::npos);
+            break;
+        }
+        else if (std::isspace(static_cast<unsigned char>(c)))
+        {
+            space = true;
+            continue;
+        }
+        if (space && !normalized.empty())
+            normalized += ' ';
+        space = false;
+        normalized += c;
+    }
+    while (!normalized.empty() && (normalized.back() == ';' || std::isspace(static_cast<unsigned char>(normalized.back()))))
+        normalized.pop_back();
+    return normalized;
+}
+
+sqlite3_stmt *StatementCache::get(const std::string &normalizedSql)
+{
+    auto found = _index.find(normalizedSql);
+    if (found == _index.end())
+    {
+        _misses++;
+        return nullptr;
+    }
+    _hits++;
+    _entries.splice(_entries.begin(), _entries, found->second);
+    return found->second->statement;
+}
+
+bool StatementCache::put(const std::string &normalizedSql, sqlite3_stmt *statement)
+{
+    if (_capacity == 0)
+        return false;
+    auto found = _index.find(normalizedSql);
+    if (found != _index.end())
+    {
+        if (found->second->statement != statement)
+            sqlite3_finalize(found->second->statement);
+        found->second->statement = statement;
+        _entries.splice(_entries.begin(), _entries, found->second);
+        return true;
+    }
+    while (_entries.size() >= _capacity)
+    {
+        sqlite3_finalize(_entries.back().statement);
+        _index.erase(_entries.back().sql);
+        _entries.pop_back();
+    }
+    _entries.push_front({normalizedSql, statement});
+    _index[normalizedSql] = _entries.begin();
+    return true;
+}
+
+void StatementCache::setCapacity(unsigned int capacity)
+{
+    _capacity = capacity;
+    while (_entries.size() > _capacity)
+    {
+        sqlite3_finalize(_entries.back().statement);
+        _index.erase(_entries.back().sql);
+        _entries.pop_back();
+    }
+}
+
+StatementCache::Statistics StatementCache::statistics() const
+{
+    return {_hits, _misses, static_cast<unsigned int>(_entries.size()), _capacity};
+}
+
+void StatementCache::clear()
+{
+    for (auto &i : _entries)
+        sqlite3_finalize(i.statement);
+    _entries.clear();
+    _index.clear();
+}
+
+StatementCache::~StatementCache()
+{
+    clear();
+}
@@ -0,0 +1,46 @@
+#ifndef STATEMENTCACHE_H
+#define STATEMENTCACHE_H
+#include <sqlite3.h>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+//LRU cache of prepared statements of one connection keyed by normalized SQL text.
+//Statements stay owned by the cache and are finalized on eviction or clear().
+class StatementCache
+{
+    struct Entry
+    {
+        std::string sql;
+        sqlite3_stmt *statement;
+    };
+    std::list<Entry> _entries;//Most recently used statement is at the front
+    std::unordered_map<std::string, std::list<Entry>::iterator> _index;
+    unsigned int _capacity;
+    unsigned long long _hits;
+    unsigned long long _misses;
+public:
+    struct Statistics
+    {
+        unsigned long long hits;
+        unsigned long long misses;
+        unsigned int size;
+        unsigned int capacity;
+    };
+    explicit StatementCache(unsigned int capacity = 128);
+    StatementCache(const StatementCache &other) = delete;
+    StatementCache &operator = (const StatementCache &other) = delete;
+    //Collapses whitespace outside of literals and drops trailing ';' so that
+    //differently formatted copies of the same statement share one cache entry
+    static std::string normalize(const std::string &sql);
+    //Returns nullptr on miss. Returned statement is reset and ready to be stepped
+    sqlite3_stmt *get(const std::string &normalizedSql);
+    //Returns false if the cache can't keep statements. Caller stays the owner of the statement then
+    bool put(const std::string &normalizedSql, sqlite3_stmt *statement);
+    void setCapacity(unsigned int capacity);
+    Statistics statistics() const;
+    void clear();
+    ~StatementCache();
+};
+
+#endif // STATEMENTCACHE_H
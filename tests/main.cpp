@@ -0,0 +1,305 @@
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "result.h"
+
+//Checks that results survive the text, stream and binary formats and that malformed input is rejected
+//with std::invalid_argument instead of being read past its end. Prints every failed check and exits with 1.
+
+using namespace std;
+
+namespace
+{
+int failures = 0;
+
+#define CHECK(condition) check((condition), #condition, __FILE__, __LINE__)
+
+void check(bool passed, const char *condition, const char *file, int line)
+{
+    if (passed)
+        return;
+    failures++;
+    printf("%s:%d: check failed: %s\n", file, line, condition);
+}
+
+bool rejects(const function<void()> &parse)
+{
+    try
+    {
+        parse();
+    }
+    catch (const invalid_argument &)
+    {
+        return true;
+    }
+    return false;
+}
+
+//Columns: id INTEGER, price REAL, name TEXT, data BLOB, empty of NULLs only. Row 1 is NULL in every column
+void fillTyped(Result &result)
+{
+    result.resize(5);
+    const char *names[] = {"id", "price", "name", "data", "empty"};
+    for (int i = 0; i < 5; i++)
+        result.addColumn(names[i], i);
+    const char blob[] = {'\0', '\n', '\x1E', '\x1F', '\xFF'};
+    result.addInteger(-42, 0);
+    result.addFloat(0.5, 1);
+    result.addText("a\nb", 3, 2);
+    result.addBlob(blob, sizeof(blob), 3);
+    result.addNull(4);
+    for (int i = 0; i < 5; i++)
+        result.addNull(i);
+    result.addInteger(INT64_MAX, 0);
+    result.addFloat(-1e300, 1);
+    result.addText("x\x1Fy\x1Ez", 5, 2);
+    result.addBlob(blob, 0, 3);
+    result.addNull(4);
+}
+
+void testBinaryRoundTrip()
+{
+    Result result, parsed;
+    fillTyped(result);
+    parsed.resultFromBinary(result.resultToBinary());
+    CHECK(parsed.size() == 5);
+    CHECK(parsed.rows() == 3);
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK(parsed.columnName(i) == result.columnName(i));
+        CHECK(parsed.columnType(i) == result.columnType(i));
+    }
+    CHECK(parsed.columnType(4) == Result::Null);
+    CHECK(parsed.integerAt(0, 0) == -42);
+    CHECK(parsed.integerAt(0, 2) == INT64_MAX);
+    CHECK(parsed.floatAt(1, 0) == 0.5);
+    CHECK(parsed.floatAt(1, 2) == -1e300);
+    CHECK(parsed.bytesAt(2, 0) == "a\nb");
+    CHECK(parsed.bytesAt(2, 2) == string_view("x\x1Fy\x1Ez", 5));
+    CHECK(parsed.bytesAt(3, 0) == string_view("\0\n\x1E\x1F\xFF", 5));
+    CHECK(parsed.bytesAt(3, 2).empty());
+    CHECK(!parsed.isNull(3, 2));
+    for (int i = 0; i < 5; i++)
+    {
+        CHECK(parsed.isNull(i, 1));
+        CHECK(parsed.typeAt(i, 1) == Result::Null);
+    }
+    CHECK(parsed.isNull(4, 0) && parsed.isNull(4, 2));
+    CHECK(parsed.resultToBinary() == result.resultToBinary());
+}
+
+void testTextRoundTrip()
+{
+    //Text keeps no types or NULLs: values come back as Text and NULL as an empty string.
+    //Values may hold the separators of the stream format but not \n
+    Result result, parsed;
+    result.resize(3);
+    result.addColumn("id", 0);
+    result.addColumn("price", 1);
+    result.addColumn("name", 2);
+    result.addInteger(7, 0);
+    result.addFloat(2.0, 1);
+    result.addValue("x\x1Fy\x1E", 2);
+    result.addNull(0);
+    result.addNull(1);
+    result.addValue("", 2);
+    string text = result.resultToString();
+    parsed.resultFromString(text);
+    CHECK(parsed.size() == 3);
+    CHECK(parsed.rows() == 2);
+    CHECK(parsed.columns(",") == "id,price,name");
+    CHECK(parsed.columnType(0) == Result::Text);
+    CHECK(parsed.valueAt(0, 0) == "7");
+    CHECK(parsed.valueAt(1, 0) == "2.0");
+    CHECK(parsed.valueAt("name", 0) == "x\x1Fy\x1E");
+    CHECK(parsed.valueAt(0, 1).empty());
+    CHECK(parsed.valueAt(2, 1).empty());
+    CHECK(parsed.resultToString() == text);
+    Result moved;
+    moved.resultFromString(string(text));
+    CHECK(moved.resultToString() == text);
+}
+
+void testStreamRoundTrip()
+{
+    //Stream values may hold \n, NULL is an empty string
+    string stream;
+    Result::streamHeaderToString(stream, {"id", "note"});
+    char id[] = "1", note[] = "line\nbreak";
+    char *first[] = {id, note}, *second[] = {nullptr, nullptr};
+    Result::streamRowToString(stream, 2, first);
+    Result::streamRowToString(stream, 2, second);
+    Result parsed;
+    parsed.resultFromStream(stream);
+    CHECK(parsed.size() == 2);
+    CHECK(parsed.rows() == 2);
+    CHECK(parsed.columnName(1) == "note");
+    CHECK(parsed.valueAt(0, 0) == "1");
+    CHECK(parsed.valueAt(1, 0) == "line\nbreak");
+    CHECK(parsed.valueAt(0, 1).empty());
+    CHECK(parsed.valueAt(1, 1).empty());
+    Result moved;
+    moved.resultFromStream(move(stream));
+    CHECK(moved.rows() == 2);
+}
+
+void testEmptyResults()
+{
+    Result empty, parsed;
+    parsed.resultFromString(empty.resultToString());
+    CHECK(parsed.size() == 0 && parsed.rows() == 0);
+    parsed.resultFromBinary(empty.resultToBinary());
+    CHECK(parsed.size() == 0 && parsed.rows() == 0);
+    string stream;
+    Result::streamHeaderToString(stream, {});
+    parsed.resultFromStream(stream);
+    CHECK(parsed.size() == 0 && parsed.rows() == 0);
+
+    //Columns but no rows
+    Result noRows;
+    noRows.resize(2);
+    noRows.addColumn("a", 0);
+    noRows.addColumn("", 1);
+    parsed.resultFromString(noRows.resultToString());
+    CHECK(parsed.size() == 2 && parsed.rows() == 0);
+    CHECK(parsed.columnName(1).empty());
+    parsed.resultFromBinary(noRows.resultToBinary());
+    CHECK(parsed.size() == 2 && parsed.rows() == 0);
+    CHECK(parsed.columnName(0) == "a");
+    stream.clear();
+    Result::streamHeaderToString(stream, {"a", ""});
+    parsed.resultFromStream(stream);
+    CHECK(parsed.size() == 2 && parsed.rows() == 0);
+}
+
+void testMixedTypes()
+{
+    //Integers and floats of a column are kept as the text SQLite gives for each of them,
+    //so integers beyond the precision of a double don't change. NULLs stay NULL
+    Result result;
+    result.resize(3);
+    result.addColumn("integerFirst", 0);
+    result.addColumn("floatFirst", 1);
+    result.addColumn("withText", 2);
+    result.addInteger(1, 0);
+    result.addFloat(0.25, 1);
+    result.addInteger(1, 2);
+    result.addNull(0);
+    result.addNull(1);
+    result.addFloat(1.5, 2);
+    result.addFloat(2.5, 0);
+    result.addInteger(INT64_C(9007199254740993), 1);
+    result.addValue("x", 2);
+    result.addInteger(INT64_MIN, 0);
+    result.addFloat(3.0, 1);
+    result.addNull(2);
+    for (int i = 0; i < 3; i++)
+        CHECK(result.columnType(i) == Result::Text);
+    CHECK(result.valueAt(0, 0) == "1");
+    CHECK(result.isNull(0, 1) && result.isNull(1, 1));
+    CHECK(result.valueAt(0, 2) == "2.5");
+    CHECK(result.valueAt(0, 3) == "-9223372036854775808");
+    CHECK(result.valueAt(1, 0) == "0.25");
+    CHECK(result.valueAt(1, 2) == "9007199254740993");
+    CHECK(result.valueAt(1, 3) == "3.0");
+    CHECK(result.valueAt(2, 0) == "1" && result.valueAt(2, 1) == "1.5" && result.valueAt(2, 2) == "x");
+    Result parsed;
+    parsed.resultFromBinary(result.resultToBinary());
+    CHECK(parsed.valueAt(0, 0) == "1" && parsed.valueAt(1, 2) == "9007199254740993");
+    CHECK(parsed.isNull(0, 1) && parsed.isNull(2, 3));
+    parsed.resultFromString(result.resultToString());
+    CHECK(parsed.valueAt(0, 3) == "-9223372036854775808" && parsed.valueAt(1, 2) == "9007199254740993");
+
+    //A column of integers only keeps them exactly as integers
+    Result integers;
+    integers.resize(1);
+    integers.addColumn("big", 0);
+    integers.addInteger(INT64_C(9007199254740993), 0);
+    integers.addInteger(INT64_MAX, 0);
+    parsed.resultFromBinary(integers.resultToBinary());
+    CHECK(parsed.columnType(0) == Result::Integer);
+    CHECK(parsed.integerAt(0, 0) == INT64_C(9007199254740993) && parsed.integerAt(0, 1) == INT64_MAX);
+}
+
+void testMalformedText()
+{
+    Result parsed;
+    CHECK(rejects([&] { parsed.resultFromString(""); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:1\n"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:x\nRows:0\n"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:1\nRows:-1\nColumn:a"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:3\nRows:0\nColumn:a\nColumn:b\nColumn"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:1\nRows:3\nColumn:a\n1\n2"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:1\nRows:0\nName:a"); }));
+    //Counts far beyond the input are rejected before memory is reserved for them
+    CHECK(rejects([&] { parsed.resultFromString("Columns:1\nRows:4000000000\nColumn:a\n1"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:4000000000\nRows:1\nColumn:a\n1"); }));
+    CHECK(rejects([&] { parsed.resultFromString("Columns:1\nRows:99999999999999999999\nColumn:a"); }));
+
+    //Prefixes which lose more than the last value are missing a value, a column or the header
+    Result result;
+    result.resize(2);
+    result.addColumn("a", 0);
+    result.addColumn("b", 1);
+    result.addValue("12", 0);
+    result.addValue("34", 1);
+    string text = result.resultToString();
+    text.pop_back();//EOF marker
+    for (size_t i = 0; i + 2 < text.size(); i++)
+        CHECK(rejects([&] { parsed.resultFromString(text.substr(0, i)); }));
+}
+
+void testMalformedStream()
+{
+    Result parsed;
+    CHECK(rejects([&] { parsed.resultFromStream(""); }));
+    CHECK(rejects([&] { parsed.resultFromStream("Columns:2\nColumn:a\n"); }));
+    CHECK(rejects([&] { parsed.resultFromStream("Columns:2\nColumn:a\nColumn:b\n1"); }));
+    CHECK(rejects([&] { parsed.resultFromStream("Columns:2\nColumn:a\nColumn:b\n1\x1E"); }));
+}
+
+void testMalformedBinary()
+{
+    Result result, parsed;
+    fillTyped(result);
+    string binary = result.resultToBinary();
+    for (size_t i = 0; i < binary.size(); i++)
+        CHECK(rejects([&] { parsed.resultFromBinary(binary.substr(0, i)); }));
+
+    //Unknown column type
+    CHECK(rejects([&] { parsed.resultFromBinary(string("\x01\x01" "a\x09\x00", 5)); }));
+    //Varint which never ends
+    CHECK(rejects([&] { parsed.resultFromBinary(string(12, '\xFF')); }));
+    //Huge counts of columns, rows and value lengths
+    CHECK(rejects([&] { parsed.resultFromBinary(string("\xFF\xFF\xFF\xFF\x0F", 5)); }));
+    CHECK(rejects([&] { parsed.resultFromBinary(string("\x01\x01" "a\x03" "\xFF\xFF\xFF\xFF\x0F" "\x00\x01x", 12)); }));
+    CHECK(rejects([&] { parsed.resultFromBinary(string("\x01\x01" "a\x01" "\xFF\xFF\xFF\xFF\x0F" "\x00", 10)); }));
+    CHECK(rejects([&] { parsed.resultFromBinary(string("\x01\x01" "a\x03\x01\x00" "\xFF\xFF\xFF\xFF\x0F", 11)); }));
+    //A result which parsed before is replaced, not appended to
+    parsed.resultFromBinary(binary);
+    parsed.resultFromBinary(binary);
+    CHECK(parsed.rows() == 3 && parsed.size() == 5);
+}
+}
+
+int main()
+{
+    testBinaryRoundTrip();
+    testTextRoundTrip();
+    testStreamRoundTrip();
+    testEmptyResults();
+    testMixedTypes();
+    testMalformedText();
+    testMalformedStream();
+    testMalformedBinary();
+    if (failures != 0)
+    {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}
@@ -0,0 +1,16 @@
+TEMPLATE = app
+TARGET = tests
+CONFIG += console c++17 thread
+CONFIG -= app_bundle
+CONFIG -= qt
+
+INCLUDEPATH += ..
+
+SOURCES += \
+        main.cpp \
+        ../arena.cpp \
+        ../result.cpp
+
+HEADERS += \
+        ../arena.h \
+        ../result.h
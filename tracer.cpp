@@ -0,0 +1,120 @@
+#include "tracer.h"
+#include <cstdio>
+#include <fstream>
+#include "json.h"
+
+Tracer::Tracer() : _every(0), _seen(0), _lastRequest(0), _started(Clock::now()), _dropped(0)
+{
+
+}
+
+unsigned int Tracer::_thread()
+{
+    static std::atomic<unsigned int> lastThread(0);
+    thread_local unsigned int thread = ++lastThread;
+    return thread;
+}
+
+void Tracer::_add(Event &&event)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    if (_events.size() >= maxEvents)
+    {
+        _dropped++;
+        return;
+    }
+    _events.push_back(std::move(event));
+}
+
+void Tracer::setSampling(unsigned int every)
+{
+    _every.store(every, std::memory_order_relaxed);
+}
+
+unsigned int Tracer::sampling() const
+{
+    return _every.load(std::memory_order_relaxed);
+}
+
+uint64_t Tracer::sample()
+{
+    unsigned int every = _every.load(std::memory_order_relaxed);
+    if (every == 0 || _seen.fetch_add(1, std::memory_order_relaxed) % every != 0)
+        return 0;
+    return _lastRequest.fetch_add(1, std::memory_order_relaxed) + 1;
+}
+
+void Tracer::span(const char *name, uint64_t request, Clock::time_point begin, Clock::time_point end, const std::string &detail)
+{
+    if (request == 0)
+        return;
+    _add({name, 'X', _thread(), request, begin - _started, end - begin, detail});
+}
+
+void Tracer::wait(const char *name, uint64_t request, Clock::time_point begin, Clock::time_point end)
+{
+    if (request == 0)
+        return;
+    _add({name, 'b', _thread(), request, begin - _started, Clock::duration::zero(), std::string()});
+    _add({name, 'e', _thread(), request, end - _started, Clock::duration::zero(), std::string()});
+}
+
+std::size_t Tracer::events()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _events.size();
+}
+
+static std::string microseconds(Tracer::Clock::duration duration)
+{
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.3f", std::chrono::duration<double, std::micro>(duration).count());
+    return text;
+}
+
+bool Tracer::write(const std::string &path, std::size_t &written)
+{
+    std::vector<Event> events;
+    unsigned long long dropped;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        events.swap(_events);
+        dropped = _dropped;
+        _dropped = 0;
+    }
+    written = events.size();
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"otherData\":{\"dropped_events\":" + std::to_string(dropped) + "},\"traceEvents\":[";
+    for (std::size_t i = 0; i < events.size(); i++)
+    {
+        const Event &event = events[i];
+        out += i != 0 ? ",\n" : "\n";
+        out += "{\"name\":\"";
+        out += event.name;
+        out += "\",\"ph\":\"";
+        out += event.phase;
+        out += "\",\"pid\":1,\"tid\":" + std::to_string(event.thread) + ",\"ts\":" + microseconds(event.begin);
+        if (event.phase == 'X')
+        {
+            out += ",\"cat\":\"work\",\"dur\":" + microseconds(event.duration) + ",\"args\":{\"request\":" + std::to_string(event.request);
+            if (!event.detail.empty())
+            {
+                out += ",\"detail\":";
+                appendJsonString(out, event.detail);
+            }
+            out += '}';
+        }
+        else
+            out += ",\"cat\":\"request\",\"id\":" + std::to_string(event.request);
+        out += '}';
+    }
+    out += "\n]}\n";
+    //Readers of the file never see it half written
+    std::string temporary = path + ".tmp";
+    {
+        std::ofstream file(temporary, std::ios::trunc);
+        file << out;
+        if (!file)
+            return false;
+    }
+    return std::rename(temporary.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,57 @@
+#ifndef TRACER_H
+#define TRACER_H
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <vector>
+
+//Spans of sampled requests written as Chrome trace JSON, which Perfetto and chrome://tracing open.
+//Work done by a thread is shown on the track of that thread, waits between threads (queues) on the
+//track of the request. Tracing is off until setSampling() is given a period.
+class Tracer
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    enum {maxEvents = 1000000};//Events above this are dropped until the trace is written
+private:
+    struct Event
+    {
+        const char *name;
+        char phase;//'X' - work of a thread, 'b' and 'e' - begin and end of a wait of a request
+        unsigned int thread;
+        uint64_t request;
+        Clock::duration begin;//Since the tracer was created
+        Clock::duration duration;
+        std::string detail;
+    };
+    std::atomic<unsigned int> _every;
+    std::atomic<uint64_t> _seen;
+    std::atomic<uint64_t> _lastRequest;
+    Clock::time_point _started;
+    std::mutex _lock;
+    std::vector<Event> _events;
+    unsigned long long _dropped;
+    static unsigned int _thread();
+    void _add(Event &&event);
+public:
+    Tracer();
+    Tracer(const Tracer &other) = delete;
+    Tracer &operator = (const Tracer &other) = delete;
+    //Every n-th request is traced, 0 stops tracing. Events recorded so far are kept
+    void setSampling(unsigned int every);
+    unsigned int sampling() const;
+    //Id of a request to be traced, 0 if the request is not sampled
+    uint64_t sample();
+    //Work of the calling thread for the request
+    void span(const char *name, uint64_t request, Clock::time_point begin, Clock::time_point end, const std::string &detail = std::string());
+    //Time the request waited between threads, e.g. in a queue
+    void wait(const char *name, uint64_t request, Clock::time_point begin, Clock::time_point end);
+    std::size_t events();
+    //Writes the trace and forgets its events. Returns false if the file can't be written
+    bool write(const std::string &path, std::size_t &written);
+};
+
+#endif // TRACER_H
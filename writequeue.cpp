@@ -0,0 +1,294 @@
+#include "writequeue.h"
+#include <cctype>
+#include <stdexcept>
+
+WriteQueue::WriteQueue(ConnectionPool &pool, DatabaseExecutor &executor) : WriteQueue(pool, executor, Settings())
+{
+
+}
+
+WriteQueue::WriteQueue(ConnectionPool &pool, DatabaseExecutor &executor, const Settings &settings, ResultCache *cache) :
+    _settings(settings), _pool(pool), _executor(executor), _cache(cache)
+{
+    if (_settings.maxBatchSize == 0)
+        _settings.maxBatchSize = 1;
+}
+
+std::string WriteQueue::_firstWord(const std::string &query)
+{
+    std::string normalized = StatementCache::normalize(query);
+    std::string firstWord;
+    for (auto c : normalized)
+    {
+        if (!std::isalpha(static_cast<unsigned char>(c)))
+            break;
+        firstWord += std::tolower(static_cast<unsigned char>(c));
+    }
+    return firstWord;
+}
+
+bool WriteQueue::mustRunAlone(const std::string &query)
+{
+    static const char *statements[] = {"begin", "commit", "end", "rollback", "savepoint", "release",
+                                       "vacuum", "pragma", "attach", "detach"};
+    std::string firstWord = _firstWord(query);
+    for (auto i : statements)
+    {
+        if (firstWord == i)
+            return true;
+    }
+    return false;
+}
+
+bool WriteQueue::isReportingPragma(const std::string &query)
+{
+    return _firstWord(query) == "pragma" && query.find('=') == std::string::npos;
+}
+
+void WriteQueue::_execute(Sqlite_wrapper &connection, const Write &write)
+{
+    //Rows of writes are collected too, e.g. of INSERT ... RETURNING or a PRAGMA which reports what it set
+    if (write.parameters.empty())
+        connection.readExec(write.query);
+    else if (write.parameters.size() == 1)
+        connection.readExec(write.query, write.parameters.front());
+    else
+        connection.modifyingExecBatch(write.query, write.parameters);
+}
+
+void WriteQueue::_control(Sqlite_wrapper &connection, const std::string &query)
+{
+    connection.modifyingExec(query);
+    if (!connection.getLastError().empty())
+        throw std::runtime_error(connection.getLastError());
+}
+
+bool WriteQueue::submit(const std::string &databaseName, Write write)
+{
+    std::string name = ConnectionPool::normalizedName(databaseName);
+    std::lock_guard<std::mutex> guard(_lock);
+    Database &database = _databases[name];
+    if (database.queue.size() >= _settings.maxQueued)
+        return false;
+    if (!database.draining)
+    {
+        if (!_executor.postUnbounded(std::bind(&WriteQueue::_drain, this, name)))
+            return false;
+        database.draining = true;
+    }
+    database.queue.push_back(std::move(write));
+    return true;
+}
+
+void WriteQueue::_drain(const std::string &databaseName)
+{
+    Batch batch;
+    batch.database = databaseName;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        Database &database = _databases[databaseName];
+        while (!database.queue.empty() && batch.writes.size() < _settings.maxBatchSize)
+        {
+            batch.writes.push_back(std::move(database.queue.front()));
+            database.queue.pop_front();
+        }
+    }
+    batch.errors.resize(batch.writes.size());
+    batch.rows.resize(batch.writes.size());
+    try {
+        PooledConnection connection = _pool.acquire(databaseName);
+        _runBatch(*connection, batch);
+    } catch (std::exception &e) {
+        for (auto &i : batch.errors)
+            i = e.what();
+        _acknowledge(nullptr, batch, 0, batch.writes.size());
+    }
+    std::deque<Write> dropped;
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        Database &database = _databases[databaseName];
+        if (database.queue.empty())
+            database.draining = false;
+        else if (!_executor.postUnbounded(std::bind(&WriteQueue::_drain, this, databaseName)))
+        {
+            dropped.swap(database.queue);
+            database.draining = false;
+        }
+    }
+    Result none;
+    for (auto &i : dropped)
+        i.done("Server is stopping, write was not run", none);
+}
+
+void WriteQueue::_execute(Sqlite_wrapper &connection, Batch &batch, std::size_t write)
+{
+    //Update hook misses some changes, e.g. of WITHOUT ROWID tables, so tables are also taken from the statements
+    if (_cache != nullptr && !connection.tablesOf(batch.writes[write].query, true, batch.written))
+        batch.everything = true;
+    _execute(connection, batch.writes[write]);
+    batch.errors[write] = connection.getLastError();
+    if (batch.errors[write].empty() && connection.getLastResult().size() != 0)
+        batch.rows[write] = std::move(connection.getLastResult());
+}
+
+bool WriteQueue::_abandoned(const Write &write, std::string &error)
+{
+    if (write.cancelled != nullptr && write.cancelled->load(std::memory_order_relaxed))
+        error = "Query was cancelled";
+    else if (std::chrono::steady_clock::now() >= write.deadline)
+        error = "Query deadline was exceeded before it ran";
+    return !error.empty();
+}
+
+void WriteQueue::_runBatch(Sqlite_wrapper &connection, Batch &batch)
+{
+    using Clock = std::chrono::steady_clock;
+    std::size_t first = 0;//First write of the open transaction which isn't acknowledged yet
+    Clock::time_point started = Clock::now();
+    if (_cache != nullptr)
+    {
+        connection.trackChanges(true);
+        batch.schemaVersion = connection.schemaVersion();
+    }
+    std::vector<std::string> &errors = batch.errors;
+    try {
+        for (std::size_t i = 0; i < batch.writes.size(); i++)
+        {
+            //Such a write is answered together with the writes of the transaction around it
+            if (_abandoned(batch.writes[i], errors[i]))
+                continue;
+            if (mustRunAlone(batch.writes[i].query))
+            {
+                _commit(connection, batch, first, i);
+                connection.setInterruption(batch.writes[i].deadline, batch.writes[i].cancelled);
+                _execute(connection, batch, i);
+                connection.clearInterruption();
+                if (connection.inTransaction())
+                {
+                    //Transaction can't outlive the request, the next one may get another connection
+                    connection.modifyingExec("rollback");
+                    if (errors[i].empty())
+                        errors[i] = "Transaction has to be finished by the query which opened it";
+                }
+                _acknowledge(&connection, batch, i, i + 1);
+                first = i + 1;
+                started = Clock::now();
+                continue;
+            }
+            if (!connection.inTransaction())
+                _control(connection, "begin immediate");
+            _control(connection, "savepoint write");
+            _execute(connection, batch, i);
+            if (!connection.inTransaction())
+            {
+                //Script of the write committed the transaction with every write before it
+                //or its error made SQLite roll the whole transaction back
+                for (std::size_t j = first; j < i && !errors[i].empty(); j++)
+                    errors[j] = "Transaction was rolled back: " + errors[i];
+                _acknowledge(&connection, batch, first, i + 1);
+                first = i + 1;
+                started = Clock::now();
+                continue;
+            }
+            if (!errors[i].empty())
+                _control(connection, "rollback to write");
+            _control(connection, "release write");
+            if (Clock::now() - started >= _settings.maxBatchTime)
+            {
+                _commit(connection, batch, first, i + 1);
+                first = i + 1;
+                started = Clock::now();
+            }
+        }
+        _commit(connection, batch, first, batch.writes.size());
+    } catch (std::exception &e) {
+        if (connection.inTransaction())
+            connection.modifyingExec("rollback");
+        for (std::size_t i = first; i < batch.writes.size(); i++)
+            errors[i] = e.what();
+        _acknowledge(&connection, batch, first, batch.writes.size());
+    }
+}
+
+void WriteQueue::_commit(Sqlite_wrapper &connection, Batch &batch, std::size_t from, std::size_t to)
+{
+    if (from == to)
+        return;
+    if (connection.inTransaction())
+    {
+        connection.modifyingExec("commit");
+        std::string error = connection.getLastError();
+        if (!error.empty())
+        {
+            connection.modifyingExec("rollback");
+            for (std::size_t i = from; i < to; i++)
+                batch.errors[i] = "Transaction was not committed: " + error;
+        }
+        std::lock_guard<std::mutex> guard(_lock);
+        if (!error.empty())
+            _statistics.failedCommits++;
+        else
+        {
+            unsigned int size = to - from, bucket = 0;
+            while (bucket + 1 < batchSizeBuckets && (size >> (bucket + 1)) != 0)
+                bucket++;
+            _statistics.commits++;
+            _statistics.batchSizes[bucket]++;
+            if (size > _statistics.largestBatch)
+                _statistics.largestBatch = size;
+        }
+    }
+    _acknowledge(&connection, batch, from, to);
+}
+
+void WriteQueue::_acknowledge(Sqlite_wrapper *connection, Batch &batch, std::size_t from, std::size_t to)
+{
+    //Results are dropped before clients learn about the commit, so they read their own writes
+    if (_cache != nullptr && connection != nullptr)
+    {
+        std::set<std::string> changed = connection->takeChangedTables();
+        changed.insert(batch.written.begin(), batch.written.end());
+        int schemaVersion = connection->schemaVersion();
+        if (batch.everything || schemaVersion != batch.schemaVersion)
+            _cache->invalidate(batch.database);
+        else if (!changed.empty())
+            _cache->invalidate(batch.database, changed);
+        batch.written.clear();
+        batch.everything = false;
+        batch.schemaVersion = schemaVersion;
+    }
+    {
+        std::lock_guard<std::mutex> guard(_lock);
+        _databases[batch.database].generation++;
+        for (std::size_t i = from; i < to; i++)
+        {
+            _statistics.writes++;
+            if (!batch.errors[i].empty())
+                _statistics.failedWrites++;
+        }
+    }
+    for (std::size_t i = from; i < to; i++)
+    {
+        //Rows of a write which was rolled back afterwards are not sent
+        if (!batch.errors[i].empty())
+            batch.rows[i].clear();
+        batch.writes[i].done(batch.errors[i], batch.rows[i]);
+    }
+}
+
+unsigned long long WriteQueue::generation(const std::string &databaseName)
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _databases[ConnectionPool::normalizedName(databaseName)].generation;
+}
+
+const WriteQueue::Settings &WriteQueue::settings() const
+{
+    return _settings;
+}
+
+WriteQueue::Statistics WriteQueue::statistics()
+{
+    std::lock_guard<std::mutex> guard(_lock);
+    return _statistics;
+}
@@ -0,0 +1,105 @@
+#ifndef WRITEQUEUE_H
+#define WRITEQUEUE_H
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "connectionpool.h"
+#include "databaseexecutor.h"
+#include "resultcache.h"
+
+//Modifying queries of a database are run by one writer at a time on a DatabaseExecutor thread.
+//Writes which queue up while a batch runs are committed together by the next batch: every write
+//runs in a savepoint of one transaction, so a failed write is rolled back alone and all of them
+//share a single commit. Writes are acknowledged only after their transaction was committed
+//and cached results of the tables they changed were dropped.
+class WriteQueue
+{
+public:
+    enum {batchSizeBuckets = 10};
+    struct Settings
+    {
+        unsigned int maxBatchSize = 256;//Writes taken by the writer at once
+        std::chrono::milliseconds maxBatchTime = std::chrono::milliseconds(20);//Transaction is committed after this time even if the batch isn't over
+        unsigned int maxQueued = 4096;//Writes waiting for a database above this are rejected
+    };
+    struct Statistics
+    {
+        unsigned long long writes = 0;
+        unsigned long long failedWrites = 0;
+        unsigned long long commits = 0;
+        unsigned long long failedCommits = 0;
+        unsigned int largestBatch = 0;//Most writes committed by one transaction
+        unsigned long long batchSizes[batchSizeBuckets] = {};//[n] counts commits of 2^n to 2^(n+1) - 1 writes, the last one of more
+    };
+    struct Write
+    {
+        std::string query;
+        std::vector<std::vector<std::string>> parameters;//No rows, one row or a batch as in Sqlite_wrapper::modifyingExecBatch
+        //Called on a database thread. error is empty on success, rows have no columns unless the write returned rows
+        std::function<void(const std::string &error, Result &rows)> done;
+        //Write isn't run if its turn comes after deadline or once *cancelled is true. Interrupting a running write
+        //would roll back the whole batch, so only writes which run alone are interrupted. cancelled must outlive done
+        std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::time_point::max();
+        const std::atomic<bool> *cancelled = nullptr;
+    };
+private:
+    struct Database
+    {
+        std::deque<Write> queue;
+        bool draining = false;//Writer of the database is posted or running
+        unsigned long long generation = 0;
+    };
+    struct Batch
+    {
+        std::string database;
+        std::vector<Write> writes;
+        std::vector<std::string> errors;
+        std::vector<Result> rows;
+        std::set<std::string> written;//Tables which writes not acknowledged yet are going to change
+        bool everything = false;//Changed tables are unknown
+        int schemaVersion = -1;
+    };
+    Settings _settings;
+    Statistics _statistics;
+    std::map<std::string, Database> _databases;
+    std::mutex _lock;
+    ConnectionPool &_pool;
+    DatabaseExecutor &_executor;
+    ResultCache *_cache;
+    static std::string _firstWord(const std::string &query);
+    static void _execute(Sqlite_wrapper &connection, const Write &write);
+    static void _control(Sqlite_wrapper &connection, const std::string &query);
+    void _drain(const std::string &databaseName);
+    void _runBatch(Sqlite_wrapper &connection, Batch &batch);
+    void _execute(Sqlite_wrapper &connection, Batch &batch, std::size_t write);
+    static bool _abandoned(const Write &write, std::string &error);
+    void _commit(Sqlite_wrapper &connection, Batch &batch, std::size_t from, std::size_t to);
+    //connection is nullptr if writes were not run
+    void _acknowledge(Sqlite_wrapper *connection, Batch &batch, std::size_t from, std::size_t to);
+public:
+    WriteQueue(ConnectionPool &pool, DatabaseExecutor &executor);
+    //Cached results of the tables changed by writes are dropped if cache isn't nullptr
+    WriteQueue(ConnectionPool &pool, DatabaseExecutor &executor, const Settings &settings, ResultCache *cache = nullptr);
+    WriteQueue(const WriteQueue &other) = delete;
+    WriteQueue &operator = (const WriteQueue &other) = delete;
+    //Returns false if too many writes wait for the database or the executor was stopped. done is not called then
+    bool submit(const std::string &databaseName, Write write);
+    //Statements which open or close transactions or can't run inside of one are not grouped with other writes
+    static bool mustRunAlone(const std::string &query);
+    //PRAGMA which only reports something, it doesn't assign a value. Such a PRAGMA may be read like a query
+    static bool isReportingPragma(const std::string &query);
+    //Changes before writes of the database are acknowledged. A read which started before a write was
+    //acknowledged may not show it, so its result can't answer requests which arrived after that
+    unsigned long long generation(const std::string &databaseName);
+    const Settings &settings() const;
+    Statistics statistics();
+};
+
+#endif // WRITEQUEUE_H